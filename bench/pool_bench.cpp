@@ -0,0 +1,143 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+
+// Compares concurrent_pool with malloc/free for 1 to 64 threads. Every
+// thread repeatedly allocates a burst of objects and frees them again; in
+// the cross-thread mode every thread frees the burst of its neighbour, the
+// case plain heap_pool cannot handle at all.
+//
+//   pool-bench [rounds] [burst]
+
+#include "measure/concurrent_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct object {
+  char data[64];
+};
+
+struct malloc_alloc {
+  object *alloc() { return static_cast<object *>(malloc(sizeof(object))); }
+  void dealloc(object *o) { free(o); }
+};
+
+struct pool_alloc {
+  measure::concurrent_pool<object> pool;
+  object *alloc() { return pool.alloc(); }
+  void dealloc(object *o) { pool.dealloc(o); }
+};
+
+// returns million alloc/free pairs per second
+template <typename Alloc>
+double run(Alloc &alloc, unsigned threads, unsigned rounds, unsigned burst,
+           bool cross) {
+  std::vector<std::vector<object *>> bursts(threads);
+  std::vector<std::atomic<bool>> ready(threads);
+  std::atomic<unsigned> started{0};
+
+  auto work = [&](unsigned self) {
+    auto &mine = bursts[self];
+    const unsigned other = cross ? (self + 1) % threads : self;
+    ++started;
+    while (started < threads) {
+    }
+
+    for (unsigned r = 0; r < rounds; ++r) {
+      for (unsigned i = 0; i < burst; ++i) {
+        auto o = alloc.alloc();
+        o->data[0] = static_cast<char>(i);
+        mine.push_back(o);
+      }
+
+      if (!cross) {
+        for (auto o : mine) {
+          alloc.dealloc(o);
+        }
+        mine.clear();
+        continue;
+      }
+
+      // hand the burst over, free the neighbour's one
+      ready[self] = true;
+      while (!ready[other]) {
+        std::this_thread::yield();
+      }
+      for (auto o : bursts[other]) {
+        alloc.dealloc(o);
+      }
+      bursts[other].clear();
+      ready[other] = false;
+      while (ready[self]) {
+        std::this_thread::yield();
+      }
+    }
+  };
+
+  const auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back(work, t);
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - begin;
+
+  return double(threads) * rounds * burst / elapsed.count() / 1e6;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const unsigned rounds = argc > 1 ? atoi(argv[1]) : 1000;
+  const unsigned burst = argc > 2 ? atoi(argv[2]) : 256;
+
+  printf("%-8s %-6s %12s %12s\n", "threads", "mode", "malloc M/s", "pool M/s");
+  for (unsigned threads : {1, 2, 4, 8, 16, 32, 64}) {
+    for (bool cross : {false, true}) {
+      if (cross && threads == 1) {
+        continue;
+      }
+
+      malloc_alloc m;
+      pool_alloc p;
+      const auto malloc_rate = run(m, threads, rounds, burst, cross);
+      const auto pool_rate = run(p, threads, rounds, burst, cross);
+      printf("%-8u %-6s %12.2f %12.2f\n", threads, cross ? "cross" : "local",
+             malloc_rate, pool_rate);
+    }
+  }
+  return 0;
+}
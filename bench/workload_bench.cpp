@@ -0,0 +1,265 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+
+// Drives monitors through synthetic call trees and reports what the
+// instrumentation costs end to end: every thread runs the same random traces
+// (same seed) once bare and once instrumented, each with its own monitor.
+// Trace shape: every scope calls up to `fanout` children until `depth` is
+// reached, child keys follow a Zipf distribution over `keys` ids, every
+// scope spins for about `work` nanoseconds.
+
+#include "measure/measure.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct options {
+  unsigned depth = 6;
+  unsigned fanout = 3;
+  unsigned keys = 1000;
+  double zipf = 1.1;
+  unsigned work = 200; // ns per scope
+  unsigned threads = 1;
+  unsigned traces = 20000; // per thread
+  unsigned long seed = 1;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: workload-bench [-d depth] [-f fanout] [-k keys] [-z zipf]\n"
+          "                      [-w work_ns] [-t threads] [-n traces] "
+          "[-s seed]\n");
+}
+
+// inverse-CDF sampling over precomputed cumulative weights 1/rank^s
+class zipf_keys {
+public:
+  zipf_keys(unsigned n, double s) : _cdf(n) {
+    double sum = 0;
+    for (unsigned i = 0; i < n; ++i) {
+      sum += 1 / std::pow(i + 1, s);
+      _cdf[i] = sum;
+    }
+    for (auto &c : _cdf) {
+      c /= sum;
+    }
+  }
+
+  template <typename Rng> int operator()(Rng &rng) const {
+    const double u = std::uniform_real_distribution<double>()(rng);
+    return static_cast<int>(std::lower_bound(_cdf.begin(), _cdf.end(), u) -
+                            _cdf.begin());
+  }
+
+private:
+  std::vector<double> _cdf;
+};
+
+unsigned long spins_per_usec() {
+  volatile unsigned long sink = 0;
+  const unsigned long rounds = 10 * 1000 * 1000;
+  const auto begin = clock_type::now();
+  for (unsigned long i = 0; i < rounds; ++i) {
+    sink = sink + i;
+  }
+  const std::chrono::duration<double, std::micro> took =
+      clock_type::now() - begin;
+  return static_cast<unsigned long>(rounds / took.count());
+}
+
+struct no_monitor {
+  void start(int) {}
+  void stop() {}
+};
+
+template <typename Monitor> class workload {
+public:
+  workload(const options &opt, const zipf_keys &keys, unsigned long spins,
+           Monitor &mon)
+      : _opt(opt), _keys(keys), _spins(spins), _mon(mon) {}
+
+  void run(unsigned long seed) {
+    std::mt19937_64 rng(seed);
+    for (unsigned i = 0; i < _opt.traces; ++i) {
+      scope(rng, 0);
+    }
+  }
+
+private:
+  void scope(std::mt19937_64 &rng, unsigned level) {
+    _mon.start(_keys(rng));
+    spin();
+    if (level + 1 < _opt.depth) {
+      const auto children = rng() % (_opt.fanout + 1);
+      for (unsigned long c = 0; c < children; ++c) {
+        scope(rng, level + 1);
+      }
+    }
+    _mon.stop();
+  }
+
+  void spin() {
+    volatile unsigned long sink = 0;
+    for (unsigned long i = 0; i < _spins; ++i) {
+      sink = sink + i;
+    }
+  }
+
+  const options &_opt;
+  const zipf_keys &_keys;
+  const unsigned long _spins;
+  Monitor &_mon;
+};
+
+template <typename Monitor>
+double run_threads(const options &opt, const zipf_keys &keys,
+                   unsigned long spins, std::vector<Monitor> &monitors) {
+  const auto begin = clock_type::now();
+  std::vector<std::thread> workers;
+  for (unsigned t = 0; t < opt.threads; ++t) {
+    workers.emplace_back([&, t] {
+      workload<Monitor>(opt, keys, spins, monitors[t]).run(opt.seed + t);
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  const std::chrono::duration<double> took = clock_type::now() - begin;
+  return took.count();
+}
+
+template <typename F> double time_usec(F &&func) {
+  const auto begin = clock_type::now();
+  func();
+  const std::chrono::duration<double, std::micro> took =
+      clock_type::now() - begin;
+  return took.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] != '-' || strlen(argv[i]) != 2 || i + 1 >= argc) {
+      usage();
+      return 2;
+    }
+
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+    case 'd':
+      opt.depth = std::max(1, atoi(value));
+      break;
+    case 'f':
+      opt.fanout = atoi(value);
+      break;
+    case 'k':
+      opt.keys = std::max(1, atoi(value));
+      break;
+    case 'z':
+      opt.zipf = atof(value);
+      break;
+    case 'w':
+      opt.work = atoi(value);
+      break;
+    case 't':
+      opt.threads = std::max(1, atoi(value));
+      break;
+    case 'n':
+      opt.traces = atoi(value);
+      break;
+    case 's':
+      opt.seed = strtoul(value, nullptr, 10);
+      break;
+    default:
+      usage();
+      return 2;
+    }
+  }
+
+  const zipf_keys keys(opt.keys, opt.zipf);
+  const unsigned long spins = spins_per_usec() * opt.work / 1000;
+
+  std::vector<no_monitor> bare(opt.threads);
+  const double bare_sec = run_threads(opt, keys, spins, bare);
+
+  std::vector<measure::monitor<int>> monitors(opt.threads);
+  const double instrumented_sec = run_threads(opt, keys, spins, monitors);
+
+  auto &mon = monitors.front();
+  const double report_usec = time_usec([&] { mon.report(); });
+  const double json_usec = time_usec([&] { mon.report_json(); });
+  const double view_usec = time_usec([&] {
+    for (auto e : mon.view()) {
+      (void)e.value.avg();
+    }
+  });
+
+  // top-level scopes are the traces, their children are counted separately
+  double scopes = 0;
+  for (auto &m : monitors) {
+    m.foreach_preorder([&scopes](unsigned, int, const auto &val) {
+      scopes += val.calls();
+    });
+  }
+
+  // extra CPU time spread over all scopes, assuming the threads ran on as
+  // many cores as available
+  const unsigned cores =
+      std::min(opt.threads, std::max(1u, std::thread::hardware_concurrency()));
+  const double extra_ns = (instrumented_sec - bare_sec) * 1e9 * cores;
+
+  printf("depth=%u fanout=%u keys=%u zipf=%.2f work=%uns threads=%u "
+         "traces=%u seed=%lu\n",
+         opt.depth, opt.fanout, opt.keys, opt.zipf, opt.work, opt.threads,
+         opt.traces, opt.seed);
+  printf("scopes             %.0f\n", scopes);
+  printf("bare               %.3f s\n", bare_sec);
+  printf("instrumented       %.3f s\n", instrumented_sec);
+  printf("overhead           %.2f %%\n",
+         (instrumented_sec - bare_sec) / bare_sec * 100);
+  printf("overhead/scope     %.1f ns\n", scopes ? extra_ns / scopes : 0.0);
+  printf("nodes/thread       %zu\n", mon.size());
+  printf("memory/thread      %zu bytes\n", mon.memory());
+  printf("report()           %.0f us\n", report_usec);
+  printf("report_json()      %.0f us\n", json_usec);
+  printf("view() walk        %.0f us\n", view_usec);
+  return 0;
+}
@@ -0,0 +1,193 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#pragma once
+
+#include "measure/measure.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace measure {
+
+struct alloc_counters {
+  unsigned long long allocs = 0;
+  unsigned long long bytes = 0;
+};
+
+namespace detail {
+// counters of the innermost open alloc_timer scope of this thread; a plain
+// pointer, so reading it from operator new needs no TLS initialization
+inline thread_local alloc_counters *current_allocs = nullptr;
+
+inline void charge_alloc(std::size_t size) noexcept {
+  if (auto c = current_allocs) {
+    ++c->allocs;
+    c->bytes += size;
+  }
+}
+} // namespace detail
+
+// aggregate_timer that also counts the heap allocations made while its scope
+// is the innermost open one; nested scopes save and restore the previously
+// charged node. Allocations are only seen through the operator new hooks,
+// defined by the one translation unit that includes this header with
+// MEASURE_ALLOC_HOOKS defined. The monitor's own allocations for a path
+// entered for the first time are charged to the parent, monitor::reserve()
+// avoids them.
+class alloc_timer {
+public:
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
+
+  alloc_timer() = default;
+
+  alloc_timer(usec_t elapsed, num_t calls) : _time(elapsed, calls) {}
+
+  void start() {
+    _previous = detail::current_allocs;
+    detail::current_allocs = &_counters;
+    _time.start();
+  }
+
+  void stop() {
+    _time.stop();
+    detail::current_allocs = _previous;
+  }
+
+  usec_t elapsed() const { return _time.elapsed(); }
+
+  num_t calls() const { return _time.calls(); }
+
+  double avg() const { return _time.avg(); }
+
+  unsigned long long allocs() const { return _counters.allocs; }
+
+  unsigned long long bytes() const { return _counters.bytes; }
+
+  double allocs_per_call() const {
+    return calls() ? (double)allocs() / calls() : 0;
+  }
+
+  double bytes_per_call() const {
+    return calls() ? (double)bytes() / calls() : 0;
+  }
+
+  void describe(std::ostream &stream) const {
+    stream << "allocs/call=" << allocs_per_call()
+           << " bytes/call=" << bytes_per_call();
+  }
+
+  alloc_timer &operator+=(const alloc_timer &other) {
+    _time += other._time;
+    _counters.allocs += other._counters.allocs;
+    _counters.bytes += other._counters.bytes;
+    return *this;
+  }
+
+  void scale(double factor) {
+    _time.scale(factor);
+    _counters.allocs = static_cast<unsigned long long>(_counters.allocs * factor);
+    _counters.bytes = static_cast<unsigned long long>(_counters.bytes * factor);
+  }
+
+private:
+  aggregate_timer _time;
+  alloc_counters _counters;
+  alloc_counters *_previous = nullptr;
+};
+
+} // namespace measure
+
+#ifdef MEASURE_ALLOC_HOOKS
+// Replacements of the global allocation functions; malloc itself is not
+// interposed, so allocations of C code are not seen.
+namespace measure::detail {
+inline void *hooked_alloc(std::size_t size) {
+  charge_alloc(size);
+  if (auto p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+inline void *hooked_alloc(std::size_t size, std::align_val_t align) {
+  charge_alloc(size);
+  const auto a = static_cast<std::size_t>(align);
+  if (auto p = std::aligned_alloc(a, (size + a - 1) / a * a)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+} // namespace measure::detail
+
+void *operator new(std::size_t size) {
+  return measure::detail::hooked_alloc(size);
+}
+
+void *operator new[](std::size_t size) {
+  return measure::detail::hooked_alloc(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  measure::detail::charge_alloc(size);
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  measure::detail::charge_alloc(size);
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  return measure::detail::hooked_alloc(size, align);
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return measure::detail::hooked_alloc(size, align);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+#endif
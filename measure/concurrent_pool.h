@@ -0,0 +1,253 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#pragma once
+
+#include "measure/measure.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace measure {
+
+// Thread-safe front-end for heap_pool. Every thread allocates from and frees
+// into its own magazine, a small array of free objects, without any
+// synchronization; the shared heap_pool is only locked to move a whole batch
+// between it and a magazine. Threads that free objects without ever having
+// allocated from the pool (e.g. a thread that only releases snapshots) push
+// them to a lock-free stack, which allocating threads drain before taking
+// the lock.
+//
+// Objects cached in the magazine of an exited thread are not reused before
+// the pool is destroyed; the pool must outlive every thread using it.
+template <typename T, unsigned Batch = 32> class concurrent_pool final {
+public:
+  using size_type = typename heap_pool<T>::size_type;
+
+  concurrent_pool() : _id(next_id()), _slot(acquire_slot()) {}
+
+  ~concurrent_pool() { release_slot(_slot); }
+
+  concurrent_pool(const concurrent_pool &) = delete;
+  concurrent_pool &operator=(const concurrent_pool &) = delete;
+
+  T *alloc() {
+    auto &m = local();
+    if (m.count == 0) {
+      refill(m);
+      if (m.count == 0) {
+        return nullptr;
+      }
+    }
+    return m.items[--m.count];
+  }
+
+  void dealloc(T *t) noexcept {
+    auto m = find_local();
+    if (!m) {
+      push_remote(t);
+      return;
+    }
+
+    if (m->count == capacity) {
+      flush(*m);
+    }
+    m->items[m->count++] = t;
+  }
+
+  template <typename... Args> T *construct(Args &&...args) {
+    T *o = alloc();
+    if (o) {
+      new (o) T(std::forward<Args>(args)...);
+    }
+    return o;
+  }
+
+  void destroy(T *t) {
+    t->~T();
+    dealloc(t);
+  }
+
+  // objects handed out by the central pool, including the ones cached in
+  // magazines and on the remote stack
+  size_type central_size() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _central.size();
+  }
+
+private:
+  static constexpr unsigned capacity = 2 * Batch;
+
+  struct magazine {
+    unsigned count = 0;
+    T *items[capacity];
+  };
+
+  using link = pooled_object<T>;
+
+  static uint64_t next_id() {
+    static std::atomic<uint64_t> id{0};
+    return ++id;
+  }
+
+  // Live pools hold distinct slots, which are reused once a pool is
+  // destroyed, so the per-thread table only grows to the most pools ever
+  // alive at once. An entry is matched by the pool's unique id as well, and a
+  // stale one left by a destroyed pool is overwritten, never dereferenced.
+  struct slot_registry {
+    std::mutex mutex;
+    std::vector<unsigned> free;
+    unsigned next = 0;
+  };
+
+  static slot_registry &slots() {
+    static slot_registry r;
+    return r;
+  }
+
+  static unsigned acquire_slot() {
+    auto &r = slots();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.free.empty()) {
+      return r.next++;
+    }
+    const auto slot = r.free.back();
+    r.free.pop_back();
+    return slot;
+  }
+
+  static void release_slot(unsigned slot) {
+    auto &r = slots();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.free.push_back(slot);
+  }
+
+  struct cache_entry {
+    uint64_t id = 0;
+    magazine *m = nullptr;
+  };
+
+  struct thread_cache {
+    uint64_t last_id = 0;
+    magazine *last = nullptr;
+    std::vector<cache_entry> all;
+  };
+
+  static thread_cache &cache() {
+    static thread_local thread_cache c;
+    return c;
+  }
+
+  magazine *find_local() noexcept {
+    auto &c = cache();
+    if (c.last_id == _id) {
+      return c.last;
+    }
+
+    if (_slot >= c.all.size() || c.all[_slot].id != _id) {
+      return nullptr;
+    }
+    c.last_id = _id;
+    c.last = c.all[_slot].m;
+    return c.last;
+  }
+
+  magazine &local() {
+    if (auto m = find_local()) {
+      return *m;
+    }
+
+    magazine *m;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _magazines.emplace_back(new magazine);
+      m = _magazines.back().get();
+    }
+
+    auto &c = cache();
+    if (_slot >= c.all.size()) {
+      c.all.resize(_slot + 1);
+    }
+    c.all[_slot] = {_id, m};
+    c.last_id = _id;
+    c.last = m;
+    return *m;
+  }
+
+  void push_remote(T *t) noexcept {
+    auto o = reinterpret_cast<link *>(t);
+    o->next = _remote.load(std::memory_order_relaxed);
+    while (!_remote.compare_exchange_weak(o->next, o, std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+    }
+  }
+
+  void refill(magazine &m) {
+    // taking the whole stack at once leaves no room for ABA
+    auto o = _remote.exchange(nullptr, std::memory_order_acquire);
+    while (o && m.count < capacity) {
+      auto next = o->next;
+      m.items[m.count++] = &o->obj;
+      o = next;
+    }
+
+    if (!o && m.count) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (o) {
+      auto next = o->next;
+      _central.dealloc(&o->obj);
+      o = next;
+    }
+    while (m.count < Batch) {
+      auto t = _central.alloc();
+      if (!t) {
+        break;
+      }
+      m.items[m.count++] = t;
+    }
+  }
+
+  void flush(magazine &m) noexcept {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (unsigned i = 0; i < Batch; ++i) {
+      _central.dealloc(m.items[--m.count]);
+    }
+  }
+
+  const uint64_t _id;
+  const unsigned _slot;
+  std::mutex _mutex;
+  heap_pool<T> _central;
+  std::vector<std::unique_ptr<magazine>> _magazines;
+  std::atomic<link *> _remote{nullptr};
+};
+
+} // namespace measure
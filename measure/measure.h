@@ -27,175 +27,396 @@ For more information, please refer to <http://unlicense.org/>
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include <iomanip>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
 #include <sys/time.h>
+#include <time.h>
 
 namespace measure {
 
+// Report tree. Nodes live in an arena of fixed-size chunks owned by the tree,
+// so building a report costs a handful of allocations rather than one per
+// path, and references to values stay valid while the tree grows. Children
+// are kept as sorted, contiguous ranges of node indices.
 template <typename Key, typename Val> class tree {
-  using leaves_t = std::map<Key, std::unique_ptr<tree>>;
+  using index_t = uint32_t;
+
+  struct node {
+    Key key{};
+    Val val{};
+    index_t first = 0; // children range in _links
+    index_t count = 0;
+    index_t cap = 0;
+  };
+
+  static constexpr index_t chunk_bits = 8;
+  static constexpr index_t chunk_size = 1 << chunk_bits;
 
 public:
   using self_type = tree<Key, Val>;
   using value_type = Val;
   using key_type = Key;
 
-  using iterator = typename leaves_t::iterator;
-  using const_iterator = typename leaves_t::const_iterator;
+  // handle to a node, behaves like a pointer to a subtree so that both
+  // `i->second->get()` and `*i->second` work on iterators
+  template <bool Const> class basic_ref {
+    using owner_t = std::conditional_t<Const, const tree, tree>;
+    using val_t = std::conditional_t<Const, const Val, Val>;
+
+  public:
+    basic_ref(owner_t *owner, index_t idx) : _owner(owner), _idx(idx) {}
+
+    operator basic_ref<true>() const { return {_owner, _idx}; }
+
+    const key_type &key() const { return _owner->at(_idx).key; }
+
+    val_t &get() const { return _owner->at(_idx).val; }
+
+    bool empty() const { return _owner->at(_idx).count == 0; }
+
+    auto begin() const { return basic_iterator<Const>(_owner, _idx, 0); }
+
+    auto end() const {
+      return basic_iterator<Const>(_owner, _idx, _owner->at(_idx).count);
+    }
+
+    template <typename Func> void foreach (Func &&func) const {
+      _owner->foreach_below(_idx, func);
+    }
+
+    const basic_ref *operator->() const { return this; }
+
+    basic_ref operator*() const { return *this; }
+
+  private:
+    owner_t *_owner;
+    index_t _idx;
+  };
+
+  template <bool Const> class basic_iterator {
+    using owner_t = std::conditional_t<Const, const tree, tree>;
+
+  public:
+    struct value_type {
+      const key_type &first;
+      basic_ref<Const> second;
+    };
+
+    struct pointer {
+      value_type entry;
+      const value_type *operator->() const { return &entry; }
+    };
+
+    using reference = value_type;
+    using difference_type = std::ptrdiff_t;
+    using iterator_category = std::forward_iterator_tag;
+
+    basic_iterator(owner_t *owner, index_t parent, index_t pos)
+        : _owner(owner), _parent(parent), _pos(pos) {}
+
+    value_type operator*() const {
+      const auto idx = _owner->child_at(_parent, _pos);
+      return {_owner->at(idx).key, basic_ref<Const>(_owner, idx)};
+    }
+
+    pointer operator->() const { return {**this}; }
+
+    basic_iterator &operator++() {
+      ++_pos;
+      return *this;
+    }
+
+    basic_iterator operator++(int) {
+      auto res = *this;
+      ++_pos;
+      return res;
+    }
+
+    bool operator==(const basic_iterator &other) const {
+      return _pos == other._pos && _parent == other._parent &&
+             _owner == other._owner;
+    }
+
+    bool operator!=(const basic_iterator &other) const {
+      return !(*this == other);
+    }
+
+  private:
+    owner_t *_owner;
+    index_t _parent;
+    index_t _pos;
+  };
+
+  using iterator = basic_iterator<false>;
+  using const_iterator = basic_iterator<true>;
+  using ref = basic_ref<false>;
+  using const_ref = basic_ref<true>;
 
   tree() {}
 
   tree(const tree &other) = delete;
   tree &operator=(const tree &other) = delete;
 
-  tree(tree &&other) { *this = std::move(other); }
+  tree(tree &&other) noexcept { *this = std::move(other); }
+
+  tree &operator=(tree &&other) noexcept {
+    _root = std::move(other._root);
+    _chunks = std::move(other._chunks);
+    _links = std::move(other._links);
+    _nodes = other._nodes;
+    _size = other._size;
 
-  tree &operator=(tree &&other) {
-    _val = std::move(other._val);
-    _leaves = std::move(other._leaves);
+    other.clear();
     return *this;
   }
 
   template <typename T> value_type &operator[](const T &key) {
-    return child(key)->get();
+    return at(child(key)).val;
   }
 
   template <typename T> const value_type &operator[](const T &key) const {
-    return child(key)->get();
+    return at(child(key)).val;
   }
 
-  value_type &operator[](const key_type &key) { return child(key)->get(); }
+  value_type &operator[](const key_type &key) { return at(child(key)).val; }
 
   const value_type &operator[](const key_type &key) const {
-    return child(key)->get();
+    return at(child(key)).val;
   }
 
-  void insert(const key_type &key, const value_type &val) { child(key) = val; }
+  void insert(const key_type &key, const value_type &val) {
+    at(child(key)).val = val;
+  }
+
+  bool empty() const { return _root.count == 0; }
 
-  bool empty() const { return _leaves.empty(); }
+  iterator begin() { return root().begin(); }
 
-  iterator begin() { return iterator(_leaves.begin()); }
+  iterator end() { return root().end(); }
 
-  iterator end() { return iterator(_leaves.end()); }
+  const_iterator begin() const { return root().begin(); }
 
-  const_iterator begin() const { return _leaves.begin(); }
+  const_iterator end() const { return root().end(); }
 
-  const_iterator end() const { return _leaves.end(); }
+  ref root() { return ref(this, 0); }
+
+  const_ref root() const { return const_ref(this, 0); }
 
   template <typename Func> void foreach (Func func) const {
-    for (auto i = begin(); i != end(); ++i) {
-      func(i->first, i->second->get());
-      i->second->foreach (func);
-    }
+    foreach_below(0, func);
   }
 
-  value_type &get() { return _val; }
+  value_type &get() { return _root.val; }
 
-  const value_type &get() const { return _val; }
+  const value_type &get() const { return _root.val; }
 
   template <typename T> size_t count(const T &key) const {
-    return find(key) ? 1 : 0;
+    return find(key) != npos ? 1 : 0;
   }
 
-  void erase(const key_type &key) { _leaves.erase(key); }
+  void erase(const key_type &key) { erase_child(0, key); }
 
   template <typename T> void erase(const T &key) {
-    tree *child = this;
-    tree *parent = this;
-    key_type leaf;
-    for (auto k : key) {
-      if (child != parent) {
+    index_t parent = 0;
+    index_t child = 0;
+    const key_type *leaf = nullptr;
+    for (auto &k : key) {
+      if (leaf) {
         parent = child;
       }
 
-      auto i = parent->_leaves.find(k);
-      if (i == parent->_leaves.end()) {
+      child = find_child(parent, k);
+      if (child == npos) {
         // can't find a node to remove
         return;
-      } else {
-        child = i->second.get();
-        leaf = k;
       }
+      leaf = &at(child).key;
     }
 
-    parent->erase(leaf);
+    if (leaf) {
+      const key_type k = *leaf;
+      erase_child(parent, k);
+    }
   }
 
   void clear() {
-    _leaves.clear();
-    _val = value_type();
+    _root = node();
+    _chunks.clear();
+    _links.clear();
+    _nodes = 0;
+    _size = 0;
   }
 
-  size_t size() const {
-    size_t sum = 0;
-    foreach ([&](Key &, Val &) { ++sum; })
-      ;
-    return sum;
-  }
+  size_t size() const { return _size; }
 
 private:
-  // TODO: gls::not_null
-  tree *child(const key_type &key) {
-    auto i = _leaves.find(key);
-    if (i != _leaves.end()) {
-      return i->second.get();
-    } else {
-      std::unique_ptr<self_type> res(new tree);
-      auto ptr = res.get();
-      _leaves[key] = std::move(res);
-      return ptr;
+  static constexpr index_t npos = 0xffffffff;
+
+  node &at(index_t idx) {
+    if (idx == 0) {
+      return _root;
+    }
+    --idx;
+    return _chunks[idx >> chunk_bits][idx & (chunk_size - 1)];
+  }
+
+  const node &at(index_t idx) const { return const_cast<tree *>(this)->at(idx); }
+
+  index_t child_at(index_t parent, index_t pos) const {
+    return _links[at(parent).first + pos];
+  }
+
+  const index_t *lower_bound(index_t parent, const key_type &key) const {
+    auto &p = at(parent);
+    const index_t *first = _links.data() + p.first;
+    return std::lower_bound(
+        first, first + p.count, key,
+        [this](index_t idx, const key_type &k) { return at(idx).key < k; });
+  }
+
+  index_t find_child(index_t parent, const key_type &key) const {
+    auto &p = at(parent);
+    auto i = lower_bound(parent, key);
+    if (i != _links.data() + p.first + p.count && !(key < at(*i).key)) {
+      return *i;
+    }
+    return npos;
+  }
+
+  index_t new_node(const key_type &key) {
+    const index_t idx = _nodes++;
+    if ((idx >> chunk_bits) == _chunks.size()) {
+      _chunks.emplace_back(new node[chunk_size]);
     }
+    ++_size;
+
+    const index_t res = idx + 1;
+    at(res).key = key;
+    return res;
   }
 
-  // TODO: gsl::not_null
-  const tree *child(const key_type &key) const {
-    auto i = _leaves.find(key);
-    if (i != _leaves.end()) {
-      return i->second.get();
+  index_t child(index_t parent, const key_type &key) {
+    auto i = lower_bound(parent, key);
+    const auto pos = static_cast<index_t>(i - (_links.data() + at(parent).first));
+    if (pos != at(parent).count && !(key < at(*i).key)) {
+      return *i;
     }
 
-    throw std::exception();
+    const auto idx = new_node(key);
+    auto &p = at(parent);
+    if (p.count == p.cap) {
+      // relocate the range to the end of the links with twice the room
+      const index_t cap = p.cap ? p.cap * 2 : 2;
+      const index_t first = static_cast<index_t>(_links.size());
+      _links.resize(_links.size() + cap);
+      std::copy(_links.begin() + p.first, _links.begin() + p.first + p.count,
+                _links.begin() + first);
+      p.first = first;
+      p.cap = cap;
+    }
+
+    auto range = _links.begin() + p.first;
+    std::copy_backward(range + pos, range + p.count, range + p.count + 1);
+    range[pos] = idx;
+    ++p.count;
+    return idx;
   }
 
-  // TODO: gsl::not_null
-  template <typename T> tree *child(const T &key) {
-    self_type *tr = this;
-    for (auto k : key)
-      tr = tr->child(k);
-    return tr;
+  index_t child(const key_type &key) { return child(0, key); }
+
+  index_t child(const key_type &key) const {
+    auto res = find_child(0, key);
+    if (res == npos) {
+      throw std::exception();
+    }
+    return res;
   }
 
-  // TODO: gls::not_null
-  template <typename T> const tree *child(const T &key) const {
-    const self_type *tr = this;
+  template <typename T> index_t child(const T &key) {
+    index_t idx = 0;
     for (auto &k : key)
-      tr = tr->child(k);
-    return tr;
+      idx = child(idx, k);
+    return idx;
   }
 
-  template <typename T> const tree *find(T &key) const {
-    const self_type *tr = this;
-    for (auto k : key) {
-      auto i = tr->_leaves.find(k);
-      if (i != tr->_leaves.end()) {
-        tr = i->second.get();
-      } else {
-        return nullptr;
+  template <typename T> index_t child(const T &key) const {
+    index_t idx = 0;
+    for (auto &k : key) {
+      idx = find_child(idx, k);
+      if (idx == npos) {
+        throw std::exception();
+      }
+    }
+    return idx;
+  }
+
+  template <typename T> index_t find(const T &key) const {
+    index_t idx = 0;
+    for (auto &k : key) {
+      idx = find_child(idx, k);
+      if (idx == npos) {
+        return npos;
       }
     }
+    return idx;
+  }
+
+  index_t find(const key_type &key) const { return find_child(0, key); }
+
+  void erase_child(index_t parent, const key_type &key) {
+    auto &p = at(parent);
+    auto i = lower_bound(parent, key);
+    auto last = _links.data() + p.first + p.count;
+    if (i == last || key < at(*i).key) {
+      return;
+    }
+
+    // erased nodes stay in the arena until clear()
+    _size -= 1 + subtree_size(*i);
+    std::copy(i + 1, static_cast<const index_t *>(last),
+              const_cast<index_t *>(i));
+    --p.count;
+  }
 
-    return tr;
+  size_t subtree_size(index_t idx) const {
+    size_t sum = 0;
+    auto count = [&sum](const key_type &, const value_type &) { ++sum; };
+    foreach_below(idx, count);
+    return sum;
   }
 
-  self_type *find(const key_type &key) const {
-    auto i = _leaves.find(key);
-    return i == _leaves.end() ? nullptr : i->second.get();
+  template <typename Func> void foreach_below(index_t idx, Func &func) const {
+    auto &n = at(idx);
+    for (index_t i = 0; i < n.count; ++i) {
+      auto c = _links[n.first + i];
+      func(at(c).key, at(c).val);
+      foreach_below(c, func);
+    }
   }
 
-  value_type _val;
-  leaves_t _leaves;
+  node _root;
+  std::vector<std::unique_ptr<node[]>> _chunks;
+  std::vector<index_t> _links;
+  index_t _nodes = 0;
+  size_t _size = 0;
 };
 
 template <typename T, typename = typename std::enable_if<
@@ -209,9 +430,10 @@ inline std::string to_json(std::string t) {
   return t;
 }
 
-template <typename U, typename V>
-void to_json(const tree<U, V> &tr, std::ostream &stream, int depth,
-             bool write_default_value = false) {
+namespace detail {
+template <typename Ref>
+void write_json(const Ref &tr, std::ostream &stream, int depth,
+                bool write_default_value) {
   auto pad = [depth, &stream](int delta = 0) {
     stream << std::string((depth + delta) * 4, ' ');
   };
@@ -231,9 +453,9 @@ void to_json(const tree<U, V> &tr, std::ostream &stream, int depth,
     pad(1);
     stream << '"' << i->first << "\":";
 
-    auto &child = *i->second;
+    const auto child = *i->second;
     if (child.begin() != child.end()) {
-      to_json(*i->second, stream, depth + 1, true);
+      write_json(child, stream, depth + 1, true);
     } else {
       stream << '"' << to_json(child.get()) << '"';
     }
@@ -243,6 +465,13 @@ void to_json(const tree<U, V> &tr, std::ostream &stream, int depth,
   pad();
   stream << "}";
 }
+} // namespace detail
+
+template <typename U, typename V>
+void to_json(const tree<U, V> &tr, std::ostream &stream, int depth,
+             bool write_default_value = false) {
+  detail::write_json(tr.root(), stream, depth, write_default_value);
+}
 
 template <typename U, typename V> std::string to_json(const tree<U, V> &tr) {
   std::stringstream ret;
@@ -294,6 +523,11 @@ public:
   using usec_t = unsigned long long;
   using num_t = unsigned long;
 
+  aggregate_timer() = default;
+
+  aggregate_timer(usec_t elapsed, num_t calls)
+      : _elapsed(elapsed), _calls(calls) {}
+
   void start() { _elapsed = now() - _elapsed; }
 
   void stop() {
@@ -322,6 +556,11 @@ public:
     return *this;
   }
 
+  void scale(double factor) {
+    _elapsed = static_cast<usec_t>(_elapsed * factor);
+    _calls = static_cast<num_t>(_calls * factor);
+  }
+
 private:
   static usec_t usec(timeval time) {
     return (usec_t)time.tv_sec * 1000 * 1000 + time.tv_usec;
@@ -331,613 +570,2620 @@ private:
   unsigned long _calls = 0;
 };
 
-template <typename T> union pooled_object {
-  T obj;
-  pooled_object *next;
-
-  pooled_object() {}
-  ~pooled_object() {}
-};
-
-template <typename T> class heap_pool final {
+// per-call duration statistics: min, max, mean and variance are tracked with
+// Welford's online algorithm, merging uses Chan's parallel formula so that
+// combined monitors yield exactly the statistics of the joint sample
+class stats_timer {
 public:
-  using size_type = std::size_t;
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
 
-  heap_pool() = default;
+  void start() { _started = aggregate_timer::now(); }
 
-  heap_pool(const heap_pool &) = delete;
-  heap_pool &operator=(const heap_pool &) = delete;
+  void stop() { add(aggregate_timer::now() - _started); }
 
-  heap_pool(heap_pool &&other) { move_from(std::move(other)); }
+  void add(usec_t duration) {
+    _elapsed += duration;
+    ++_calls;
 
-  heap_pool &operator=(heap_pool &&other) {
-    free_memory();
-    move_from(std::move(other));
-    return *this;
+    const double delta = duration - _mean;
+    _mean += delta / _calls;
+    _m2 += delta * (duration - _mean);
+
+    _min = std::min(_min, duration);
+    _max = std::max(_max, duration);
   }
 
-  ~heap_pool() noexcept { free_memory(); }
+  usec_t elapsed() const { return _elapsed; }
 
-  T *alloc() noexcept {
-    if (flist_ == nullptr) {
-      create_new_slab();
+  num_t calls() const { return _calls; }
 
-      if (!flist_) {
-        return nullptr;
-      }
-    }
+  double avg() const { return _mean; }
 
-    auto ret = remove_free_list_head();
-    ++size_;
-    return ret;
-  }
+  usec_t min() const { return _calls ? _min : 0; }
 
-  void dealloc(T *t) noexcept {
-    auto o = reinterpret_cast<object *>(t);
-    o->next = flist_;
-    flist_ = o;
-    --size_;
-  }
+  usec_t max() const { return _max; }
 
-  template <typename... Args> T *construct(Args &&...args) {
-    T *o = alloc();
-    if (o) {
-      new (o) T(std::forward<Args>(args)...);
+  double variance() const { return _calls > 1 ? _m2 / (_calls - 1) : 0; }
+
+  double stddev() const { return std::sqrt(variance()); }
+
+  void merge(const stats_timer &other) {
+    if (!other._calls) {
+      return;
     }
-    return o;
+
+    const double calls = _calls + other._calls;
+    const double delta = other._mean - _mean;
+    _m2 += other._m2 + delta * delta * _calls * other._calls / calls;
+    _mean += delta * other._calls / calls;
+
+    _elapsed += other._elapsed;
+    _calls += other._calls;
+    _min = std::min(_min, other._min);
+    _max = std::max(_max, other._max);
   }
 
-  void destroy(T *t) {
-    t->~T();
-    dealloc(t);
+  void describe(std::ostream &stream) const {
+    stream << "min=" << min() << " max=" << max() << " stddev=" << stddev();
   }
 
-  size_type capacity() const noexcept { return capacity_; }
+private:
+  usec_t _started = 0;
+  usec_t _elapsed = 0;
+  num_t _calls = 0;
+  double _mean = 0;
+  double _m2 = 0;
+  usec_t _min = std::numeric_limits<usec_t>::max();
+  usec_t _max = 0;
+};
 
-  size_type size() const noexcept { return size_; }
+// Wall time plus the CPU time of the calling thread (CLOCK_THREAD_CPUTIME_ID,
+// a vDSO call on Linux), so that reports tell scopes burning CPU from scopes
+// waiting on I/O, locks or the scheduler (off-CPU time)
+class cpu_timer {
+public:
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
 
-  void dealloc_all() noexcept {
-    auto s = head_;
-    object *flist = nullptr;
-    while (s) {
-      auto f = create_free_list(s);
-      f.second->next = flist;
-      flist = f.first;
-      s = s->next;
-    }
-    flist_ = flist;
-    size_ = 0;
+  cpu_timer() = default;
+
+  cpu_timer(usec_t elapsed, num_t calls) : _wall(elapsed, calls) {}
+
+  // the wall clock brackets the CPU clock
+  void start() {
+    _wall_started = aggregate_timer::now();
+    _cpu_started = now();
   }
 
-  static T *at(T *t) { return t; }
+  void stop() {
+    const auto cpu = now() - _cpu_started;
+    add(aggregate_timer::now() - _wall_started, cpu);
+  }
 
-  static const T *at(const T *t) { return t; }
+  // one call; it never charges more CPU than wall time, which the two
+  // microsecond truncations could otherwise do
+  void add(usec_t wall, usec_t cpu) {
+    _wall += aggregate_timer(wall, 1);
+    _cpu += std::min(cpu, wall);
+  }
 
-private:
-  using object = pooled_object<T>;
+  usec_t elapsed() const { return _wall.elapsed(); }
 
-  struct slab {
-    slab *next;
-    int32_t count;
-    object data[1];
-  };
+  num_t calls() const { return _wall.calls(); }
 
-  void move_from(heap_pool &&other) {
-    head_ = other.head_;
-    tail_ = other.tail_;
-    flist_ = other.flist_;
-    slab_size_ = other.slab_size_;
-    capacity_ = other.capacity_;
-    size_ = other.size_;
+  double avg() const { return _wall.avg(); }
 
-    other.set_defaults();
+  usec_t cpu() const { return _cpu; }
+
+  // wall time not spent on the CPU
+  usec_t off_cpu() const { return elapsed() > _cpu ? elapsed() - _cpu : 0; }
+
+  static usec_t now() {
+    timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return (usec_t)time.tv_sec * 1000 * 1000 + time.tv_nsec / 1000;
   }
 
-  T *remove_free_list_head() noexcept {
-    assert(flist_ != nullptr);
-    auto ret = flist_;
-    flist_ = flist_->next;
-    return &ret->obj;
+  void describe(std::ostream &stream) const {
+    stream << "wall=" << elapsed() << "us cpu=" << cpu()
+           << "us off-cpu=" << off_cpu() << "us";
   }
 
-  void free_memory() noexcept {
-    auto cur = head_;
-    while (cur) {
-      const auto next = cur->next;
-      free(cur);
-      cur = next;
-    }
+  cpu_timer &operator+=(const cpu_timer &other) {
+    _wall += other._wall;
+    _cpu += other._cpu;
+    return *this;
+  }
 
-    set_defaults();
+  void scale(double factor) {
+    _wall.scale(factor);
+    _cpu = static_cast<usec_t>(_cpu * factor);
   }
 
-  void create_new_slab() noexcept {
-    assert(slab_size_ >= 0);
+private:
+  aggregate_timer _wall;
+  usec_t _cpu = 0;
+  usec_t _wall_started = 0;
+  usec_t _cpu_started = 0;
+};
 
-    auto size = (slab_size_ - 1) * sizeof(object) + sizeof(slab);
-    auto p = static_cast<slab *>(malloc(size)); // TODO: alignment
-    if (p) {
-      p->count = slab_size_;
-      p->next = nullptr;
+// aggregate_timer plus work counters that the code inside a scope reports
+// through monitor::count() and monitor::add_bytes(), so that reports tell a
+// scope that is slower per item from one that simply handles more data
+class throughput_timer {
+public:
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
+  using count_t = unsigned long long;
 
-      enlist_new_slab(p);
-      flist_ = create_free_list(p).first;
+  throughput_timer() = default;
 
-      capacity_ += slab_size_;
-      increase_next_slab_size(size);
-    }
+  throughput_timer(usec_t elapsed, num_t calls) : _time(elapsed, calls) {}
+
+  void start() { _time.start(); }
+
+  void stop() { _time.stop(); }
+
+  void count(count_t items) { _items += items; }
+
+  void add_bytes(count_t bytes) { _bytes += bytes; }
+
+  usec_t elapsed() const { return _time.elapsed(); }
+
+  num_t calls() const { return _time.calls(); }
+
+  double avg() const { return _time.avg(); }
+
+  count_t items() const { return _items; }
+
+  count_t bytes() const { return _bytes; }
+
+  double items_per_call() const {
+    return calls() ? (double)_items / calls() : 0;
   }
 
-  void enlist_new_slab(slab *s) noexcept {
-    if (tail_) {
-      assert(!tail_->next);
-      tail_ = tail_->next = s;
-    } else {
-      head_ = tail_ = s;
-    }
+  double ns_per_item() const {
+    return _items ? elapsed() * 1000.0 / _items : 0;
   }
 
-  void increase_next_slab_size(size_t current_size) noexcept {
-    slab_size_ = current_size > 4 * 1024 ? slab_size_ : slab_size_ * 2;
+  double bytes_per_sec() const {
+    return elapsed() ? _bytes * 1e6 / elapsed() : 0;
   }
 
-  static std::pair<object *, object *> create_free_list(slab *s) {
-    auto flist = s->data;
-    auto prev = flist;
+  void describe(std::ostream &stream) const {
+    stream << "items/call=" << items_per_call() << " ns/item=" << ns_per_item()
+           << " bytes/s=" << bytes_per_sec();
+  }
 
-    for (auto i = 1; i < s->count; ++i) {
-      prev->next = &s->data[i];
-      prev = prev->next;
-    }
+  throughput_timer &operator+=(const throughput_timer &other) {
+    _time += other._time;
+    _items += other._items;
+    _bytes += other._bytes;
+    return *this;
+  }
 
-    prev->next = nullptr;
-    return {flist, prev};
+  void scale(double factor) {
+    _time.scale(factor);
+    _items = static_cast<count_t>(_items * factor);
+    _bytes = static_cast<count_t>(_bytes * factor);
   }
 
-  void set_defaults() {
-    head_ = tail_ = nullptr;
-    flist_ = nullptr;
-    slab_size_ = 1;
-    capacity_ = 0;
+private:
+  aggregate_timer _time;
+  count_t _items = 0;
+  count_t _bytes = 0;
+};
+
+// Times every call until a node turns out to be so short that the clock reads
+// cost about as much as the work inside: if, over a window of samples, the
+// average call takes less than overhead_ratio times the calibrated start/stop
+// overhead, only 1 in N calls is timed (all are counted) and each sample
+// stands for N calls. The decision is re-evaluated every window, so a node
+// that gets slower is timed fully again.
+template <unsigned N = 64> class throttled_timer {
+public:
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
+
+  static constexpr unsigned window = 64;
+  static constexpr double overhead_ratio = 10;
+
+  void start() {
+    if (_countdown == 0) {
+      _started = aggregate_timer::now();
+    }
+  }
+
+  void stop() {
+    ++_calls;
+    if (_countdown) {
+      --_countdown;
+      return;
+    }
+
+    sample(aggregate_timer::now() - _started);
+  }
+
+  // estimated total, sampled durations scaled by the sampling period
+  usec_t elapsed() const { return _elapsed; }
+
+  num_t calls() const { return _calls; }
+
+  double avg() const { return _calls ? (double)_elapsed / _calls : 0; }
+
+  bool throttled() const { return _period > 1; }
+
+  num_t sampled() const { return _sampled; }
+
+  // usec spent in one start/stop pair of a plain aggregate_timer, measured
+  // once per process
+  static double overhead() {
+    static const double usec = calibrate();
+    return usec;
+  }
+
+  void describe(std::ostream &stream) const {
+    if (throttled()) {
+      stream << "throttled=1/" << _period << " sampled=" << _sampled;
+    }
+  }
+
+  throttled_timer &operator+=(const throttled_timer &other) {
+    _elapsed += other._elapsed;
+    _calls += other._calls;
+    _sampled += other._sampled;
+    // the coarsest period seen, so a merged value still reads as throttled
+    _period = std::max(_period, other._period);
+    return *this;
+  }
+
+  void scale(double factor) {
+    _elapsed = static_cast<usec_t>(_elapsed * factor);
+    _calls = static_cast<num_t>(_calls * factor);
+    _sampled = static_cast<num_t>(_sampled * factor);
+  }
+
+private:
+  void sample(usec_t duration) {
+    ++_sampled;
+    _window_elapsed += duration;
+    if (++_window_samples == window) {
+      const double avg = (double)_window_elapsed / window;
+      _period = avg < overhead() * overhead_ratio ? N : 1;
+      _window_elapsed = 0;
+      _window_samples = 0;
+    }
+
+    _elapsed += duration * _period;
+    _countdown = _period - 1;
+  }
+
+  static double calibrate() {
+    const int rounds = 10000;
+    aggregate_timer t;
+    const auto begin = aggregate_timer::now();
+    for (int i = 0; i < rounds; ++i) {
+      t.start();
+      t.stop();
+    }
+    return double(aggregate_timer::now() - begin) / rounds;
+  }
+
+  usec_t _started = 0;
+  usec_t _elapsed = 0;
+  num_t _calls = 0;
+  num_t _sampled = 0;
+  unsigned _period = 1;
+  unsigned _countdown = 0;
+  unsigned _window_samples = 0;
+  usec_t _window_elapsed = 0;
+};
+
+// The 64-bit tag (e.g. a request id) that exemplar_timer stores with the
+// calls it keeps, per thread; set it when a request starts being processed.
+inline uint64_t &exemplar_tag() {
+  static thread_local uint64_t tag = 0;
+  return tag;
+}
+
+inline void set_exemplar_tag(uint64_t tag) { exemplar_tag() = tag; }
+
+// aggregate_timer that also keeps the K slowest calls with their duration,
+// end time and exemplar_tag(), so that a slow path leads to concrete
+// requests. The calls are kept in a fixed-size min-heap: a call faster than
+// the fastest kept one costs a single comparison.
+template <unsigned K = 4> class exemplar_timer {
+public:
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
+
+  struct exemplar {
+    usec_t duration;
+    usec_t timestamp; // aggregate_timer::now() at stop
+    uint64_t tag;
+  };
+
+  exemplar_timer() = default;
+
+  exemplar_timer(usec_t elapsed, num_t calls) : _time(elapsed, calls) {}
+
+  void start() { _started = aggregate_timer::now(); }
+
+  void stop() {
+    const auto now = aggregate_timer::now();
+    add(now - _started, now, exemplar_tag());
+  }
+
+  void add(usec_t duration, usec_t timestamp, uint64_t tag) {
+    _time += aggregate_timer(duration, 1);
+    if (_size == K && duration <= _heap[0].duration) {
+      return;
+    }
+    offer({duration, timestamp, tag});
+  }
+
+  usec_t elapsed() const { return _time.elapsed(); }
+
+  num_t calls() const { return _time.calls(); }
+
+  double avg() const { return _time.avg(); }
+
+  // the kept calls, slowest first
+  std::vector<exemplar> exemplars() const {
+    std::vector<exemplar> res(_heap, _heap + _size);
+    std::sort(res.begin(), res.end(), [](const exemplar &a, const exemplar &b) {
+      return a.duration > b.duration;
+    });
+    return res;
+  }
+
+  void describe(std::ostream &stream) const {
+    const char *sep = "slowest=";
+    for (auto &e : exemplars()) {
+      stream << sep << e.duration << "us#" << e.tag << "@" << e.timestamp;
+      sep = ",";
+    }
+  }
+
+  exemplar_timer &operator+=(const exemplar_timer &other) {
+    _time += other._time;
+    for (unsigned i = 0; i < other._size; ++i) {
+      if (_size < K || other._heap[i].duration > _heap[0].duration) {
+        offer(other._heap[i]);
+      }
+    }
+    return *this;
+  }
+
+private:
+  static bool slower(const exemplar &a, const exemplar &b) {
+    return a.duration > b.duration;
+  }
+
+  void offer(const exemplar &e) {
+    if (_size == K) {
+      std::pop_heap(_heap, _heap + _size, slower);
+      --_size;
+    }
+    _heap[_size++] = e;
+    std::push_heap(_heap, _heap + _size, slower);
+  }
+
+  usec_t _started = 0;
+  aggregate_timer _time;
+  unsigned _size = 0;
+  exemplar _heap[K] = {};
+};
+
+// Rolling time window: besides the lifetime counters, the durations go into a
+// ring of Buckets buckets of BucketUsec each (5 minutes by default). The ring
+// is rotated lazily by the recording thread, buckets that fell out of the
+// window are cleared on the next stop(); reads only skip them, so no
+// background thread is needed. Reports show the last 1 and 5 minutes.
+template <unsigned Buckets = 60, unsigned long BucketUsec = 5000000>
+class window_timer {
+public:
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
+
+  static constexpr usec_t span = usec_t(Buckets) * BucketUsec;
+
+  void start() { _started = aggregate_timer::now(); }
+
+  void stop() {
+    const auto now = aggregate_timer::now();
+    add(now - _started, now);
+  }
+
+  // records a call of `duration` that ended at `now`
+  void add(usec_t duration, usec_t now) {
+    rotate(now / BucketUsec);
+    const aggregate_timer call(duration, 1);
+    _buckets[_interval % Buckets] += call;
+    _total += call;
+  }
+
+  usec_t elapsed() const { return _total.elapsed(); }
+
+  num_t calls() const { return _total.calls(); }
+
+  double avg() const { return _total.avg(); }
+
+  // counters of the calls that ended within the last `period` usec, rounded
+  // up to whole buckets (the current one included) and capped at `span`
+  aggregate_timer window(usec_t period,
+                         usec_t now = aggregate_timer::now()) const {
+    const usec_t current = now / BucketUsec;
+    const usec_t count =
+        std::min<usec_t>(Buckets, (period + BucketUsec - 1) / BucketUsec);
+
+    aggregate_timer res;
+    for (usec_t i = 0; i < count && i <= current; ++i) {
+      const auto interval = current - i;
+      if (interval > _interval) {
+        continue; // nothing recorded yet
+      }
+      if (_interval - interval >= Buckets) {
+        break; // rotated out
+      }
+      res += _buckets[interval % Buckets];
+    }
+    return res;
+  }
+
+  // calls per second within the last `period` usec
+  double rate(usec_t period, usec_t now = aggregate_timer::now()) const {
+    period = std::min(period, span);
+    return period ? window(period, now).calls() * 1e6 / period : 0;
+  }
+
+  void describe(std::ostream &stream) const {
+    const auto now = aggregate_timer::now();
+    const usec_t minute = 60 * 1000 * 1000;
+    stream << "1m avg=" << window(minute, now).avg()
+           << " rate=" << rate(minute, now) << "/s"
+           << " 5m avg=" << window(5 * minute, now).avg()
+           << " rate=" << rate(5 * minute, now) << "/s";
+  }
+
+  // buckets are aligned by wall-clock interval, so windows recorded by
+  // different monitors add up bucket by bucket
+  window_timer &operator+=(const window_timer &other) {
+    rotate(std::max(_interval, other._interval));
+    for (usec_t i = 0; i < Buckets && i <= other._interval; ++i) {
+      const auto interval = other._interval - i;
+      if (_interval - interval >= Buckets) {
+        break;
+      }
+      _buckets[interval % Buckets] += other._buckets[interval % Buckets];
+    }
+    _total += other._total;
+    return *this;
+  }
+
+  void scale(double factor) {
+    _total.scale(factor);
+    for (auto &b : _buckets) {
+      b.scale(factor);
+    }
+  }
+
+private:
+  void rotate(usec_t interval) {
+    if (interval <= _interval) {
+      return; // same bucket, or the clock went back
+    }
+
+    const auto stale = std::min<usec_t>(interval - _interval, Buckets);
+    for (usec_t i = 1; i <= stale; ++i) {
+      _buckets[(_interval + i) % Buckets] = aggregate_timer();
+    }
+    _interval = interval;
+  }
+
+  usec_t _started = 0;
+  usec_t _interval = 0; // latest bucket, in BucketUsec since the epoch
+  aggregate_timer _total;
+  aggregate_timer _buckets[Buckets];
+};
+
+namespace detail {
+template <typename V, typename = void> struct has_describe : std::false_type {};
+
+template <typename V>
+struct has_describe<V, decltype(std::declval<const V &>().describe(
+                           std::declval<std::ostream &>()))>
+    : std::true_type {};
+
+template <typename V, typename = void> struct has_merge : std::false_type {};
+
+template <typename V>
+struct has_merge<V, decltype(std::declval<V &>().merge(
+                        std::declval<const V &>()))> : std::true_type {};
+} // namespace detail
+
+// folds `from` into `into`; value types whose statistics do not simply add up
+// provide a `void merge(const V &)` member, everything else uses operator+=
+template <typename V> void merge(V &into, const V &from) {
+  if constexpr (detail::has_merge<V>::value) {
+    into.merge(from);
+  } else {
+    into += from;
+  }
+}
+
+// writes value-specific report columns (e.g. hardware counters), if the value
+// type provides any via a `void describe(std::ostream &) const` member
+template <typename V> void describe(std::ostream &stream, const V &val) {
+  if constexpr (detail::has_describe<V>::value) {
+    val.describe(stream);
+  }
+}
+
+template <typename T> union pooled_object {
+  T obj;
+  pooled_object *next;
+
+  pooled_object() {}
+  ~pooled_object() {}
+};
+
+template <typename T> class heap_pool final {
+public:
+  using size_type = std::size_t;
+
+  heap_pool() = default;
+
+  heap_pool(const heap_pool &) = delete;
+  heap_pool &operator=(const heap_pool &) = delete;
+
+  heap_pool(heap_pool &&other) { move_from(std::move(other)); }
+
+  heap_pool &operator=(heap_pool &&other) {
+    free_memory();
+    move_from(std::move(other));
+    return *this;
+  }
+
+  ~heap_pool() noexcept { free_memory(); }
+
+  T *alloc() noexcept {
+    if (flist_ == nullptr) {
+      create_new_slab();
+
+      if (!flist_) {
+        return nullptr;
+      }
+    }
+
+    auto ret = remove_free_list_head();
+    ++size_;
+    return ret;
+  }
+
+  void dealloc(T *t) noexcept {
+    auto o = reinterpret_cast<object *>(t);
+    o->next = flist_;
+    flist_ = o;
+    --size_;
+  }
+
+  template <typename... Args> T *construct(Args &&...args) {
+    T *o = alloc();
+    if (o) {
+      new (o) T(std::forward<Args>(args)...);
+    }
+    return o;
+  }
+
+  void destroy(T *t) {
+    t->~T();
+    dealloc(t);
+  }
+
+  size_type capacity() const noexcept { return capacity_; }
+
+  size_type size() const noexcept { return size_; }
+
+  // number of slabs malloc'ed so far
+  size_type slabs() const noexcept { return slabs_; }
+
+  // makes room for `count` more objects in a single slab, so that the next
+  // `count` allocations never call malloc
+  void reserve(size_type count) {
+    const auto available = capacity_ - size_;
+    if (count <= available) {
+      return;
+    }
+
+    const auto missing = count - available;
+    auto p = static_cast<slab *>(
+        malloc((missing - 1) * sizeof(object) + sizeof(slab)));
+    if (!p) {
+      throw std::bad_alloc();
+    }
+
+    p->count = static_cast<int32_t>(missing);
+    p->next = nullptr;
+    enlist_new_slab(p);
+
+    auto f = create_free_list(p);
+    f.second->next = flist_;
+    flist_ = f.first;
+    capacity_ += missing;
+    ++slabs_;
+  }
+
+  void dealloc_all() noexcept {
+    auto s = head_;
+    object *flist = nullptr;
+    while (s) {
+      auto f = create_free_list(s);
+      f.second->next = flist;
+      flist = f.first;
+      s = s->next;
+    }
+    flist_ = flist;
     size_ = 0;
   }
 
-  slab *head_ = nullptr;
-  slab *tail_ = nullptr;
-  object *flist_ = nullptr;
-  uint16_t slab_size_ = 1;
-  size_type capacity_{};
-  size_type size_{};
+  static T *at(T *t) { return t; }
+
+  static const T *at(const T *t) { return t; }
+
+private:
+  using object = pooled_object<T>;
+
+  struct slab {
+    slab *next;
+    int32_t count;
+    object data[1];
+  };
+
+  void move_from(heap_pool &&other) {
+    head_ = other.head_;
+    tail_ = other.tail_;
+    flist_ = other.flist_;
+    slab_size_ = other.slab_size_;
+    capacity_ = other.capacity_;
+    size_ = other.size_;
+    slabs_ = other.slabs_;
+
+    other.set_defaults();
+  }
+
+  T *remove_free_list_head() noexcept {
+    assert(flist_ != nullptr);
+    auto ret = flist_;
+    flist_ = flist_->next;
+    return &ret->obj;
+  }
+
+  void free_memory() noexcept {
+    auto cur = head_;
+    while (cur) {
+      const auto next = cur->next;
+      free(cur);
+      cur = next;
+    }
+
+    set_defaults();
+  }
+
+  void create_new_slab() noexcept {
+    assert(slab_size_ >= 0);
+
+    auto size = (slab_size_ - 1) * sizeof(object) + sizeof(slab);
+    auto p = static_cast<slab *>(malloc(size)); // TODO: alignment
+    if (p) {
+      p->count = slab_size_;
+      p->next = nullptr;
+
+      enlist_new_slab(p);
+      flist_ = create_free_list(p).first;
+
+      capacity_ += slab_size_;
+      ++slabs_;
+      increase_next_slab_size(size);
+    }
+  }
+
+  void enlist_new_slab(slab *s) noexcept {
+    if (tail_) {
+      assert(!tail_->next);
+      tail_ = tail_->next = s;
+    } else {
+      head_ = tail_ = s;
+    }
+  }
+
+  void increase_next_slab_size(size_t current_size) noexcept {
+    slab_size_ = current_size > 4 * 1024 ? slab_size_ : slab_size_ * 2;
+  }
+
+  static std::pair<object *, object *> create_free_list(slab *s) {
+    auto flist = s->data;
+    auto prev = flist;
+
+    for (auto i = 1; i < s->count; ++i) {
+      prev->next = &s->data[i];
+      prev = prev->next;
+    }
+
+    prev->next = nullptr;
+    return {flist, prev};
+  }
+
+  void set_defaults() {
+    head_ = tail_ = nullptr;
+    flist_ = nullptr;
+    slab_size_ = 1;
+    capacity_ = 0;
+    size_ = 0;
+    slabs_ = 0;
+  }
+
+  slab *head_ = nullptr;
+  slab *tail_ = nullptr;
+  object *flist_ = nullptr;
+  uint16_t slab_size_ = 1;
+  size_type capacity_{};
+  size_type size_{};
+  size_type slabs_{};
+};
+
+// Node values kept apart from the trie topology, in chunks of contiguous
+// slots. Bulk passes (reset, scaling, report math) run as plain loops over
+// the chunks instead of chasing node links, and references stay valid as the
+// store grows.
+template <typename V> class value_store {
+public:
+  using slot_type = uint32_t;
+
+  slot_type alloc() {
+    if (!_free.empty()) {
+      const auto slot = _free.back();
+      _free.pop_back();
+      return slot;
+    }
+
+    if (_size == _chunks.size() * chunk_size) {
+      _chunks.emplace_back(new V[chunk_size]());
+    }
+    return _size++;
+  }
+
+  // allocates chunks up front so that `count` more slots come without malloc
+  void reserve(slot_type count) {
+    const auto free = static_cast<slot_type>(_free.size());
+    while (_size + count > _chunks.size() * chunk_size + free) {
+      _chunks.emplace_back(new V[chunk_size]());
+    }
+  }
+
+  // number of chunks allocated so far
+  std::size_t chunks() const { return _chunks.size(); }
+
+  // bytes held, including free slots
+  std::size_t memory() const {
+    return _chunks.size() * chunk_size * sizeof(V) +
+           _free.capacity() * sizeof(slot_type);
+  }
+
+  // resets the value, so bulk passes may keep visiting free slots
+  void free(slot_type slot) {
+    (*this)[slot] = V();
+    _free.push_back(slot);
+  }
+
+  V &operator[](slot_type slot) {
+    return _chunks[slot >> chunk_bits][slot & (chunk_size - 1)];
+  }
+
+  const V &operator[](slot_type slot) const {
+    return _chunks[slot >> chunk_bits][slot & (chunk_size - 1)];
+  }
+
+  slot_type size() const { return _size; }
+
+  // func(slot, value) for every allocated slot, chunk by chunk
+  template <typename F> void foreach (F &&func) {
+    for (slot_type c = 0; c * chunk_size < _size; ++c) {
+      V *chunk = _chunks[c].get();
+      const slot_type base = c * chunk_size;
+      const slot_type n = std::min<slot_type>(chunk_size, _size - base);
+      for (slot_type i = 0; i < n; ++i) {
+        func(base + i, chunk[i]);
+      }
+    }
+  }
+
+  template <typename F> void foreach (F &&func) const {
+    const_cast<value_store *>(this)->foreach (
+        [&func](slot_type slot, const V &val) { func(slot, val); });
+  }
+
+private:
+  static constexpr slot_type chunk_bits = 10;
+  static constexpr slot_type chunk_size = 1 << chunk_bits;
+
+  std::vector<std::unique_ptr<V[]>> _chunks;
+  std::vector<slot_type> _free;
+  slot_type _size = 0;
+};
+
+// TODO:
+// 1. limit stack depth
+// 2. limit number of metrics stored
+// 3. contiguos object pool
+// 4. make trie copy-able
+// 5. perfect forwarding of functor args (lambdas)
+// 6. better sampling options: medians?
+template <typename K, typename V, int N = 254> class trie {
+  struct node;
+
+public:
+  using key_type = K;
+  using value_type = V;
+  using self_type = trie<K, V, N>;
+
+  ~trie() { destroy_nodes(); }
+
+  trie() = default;
+
+  trie(trie &&other) noexcept { *this = std::move(other); }
+
+  trie &operator=(trie &&other) noexcept {
+    destroy_nodes();
+    cursor = other.cursor;
+    root = other.root;
+    trie_depth = other.trie_depth;
+    pool = std::move(other.pool);
+    values = std::move(other.values);
+    epoch = other.epoch;
+
+    other.cursor = other.root = nullidx;
+    other.trie_depth = 0;
+    return *this;
+  }
+
+  trie(const trie &) = delete;
+  trie &operator=(const trie &) = delete;
+
+  value_type &up() {
+    assert(cursor != nullidx);
+    assert(trie_depth > 0);
+
+    auto &res = value_at(cursor);
+    cursor = at(cursor).parent;
+    --trie_depth;
+    return res;
+  }
+
+  template <typename F> void up(F &&value_func) {
+    assert(cursor != nullidx);
+    assert(trie_depth > 0);
+
+    value_at(cursor) = value_func(value_at(cursor));
+    cursor = at(cursor).parent;
+    --trie_depth;
+  }
+
+  value_type &down(key_type key) {
+    if (cursor != nullidx) {
+      cursor = add_child(cursor, key);
+    } else {
+      cursor = root;
+      while (cursor != nullidx && key != at(cursor).key) {
+        cursor = cursor->sibling;
+      }
+
+      if (cursor == nullidx) {
+        cursor = new_node(key);
+        cursor->sibling = root;
+        root = cursor;
+      }
+    }
+
+    ++at(cursor).hits;
+    ++trie_depth;
+    return value_at(cursor);
+  }
+
+  template <typename F> void down(key_type key, F &&value_func) {
+    down(key);
+    value_at(cursor) = value_func(value_at(cursor));
+  }
+
+  value_type &get() {
+    assert(cursor != nullidx);
+    return value_at(cursor);
+  }
+
+  value_type &at(std::initializer_list<key_type> &&path) {
+    auto res = nullidx;
+    for (auto p : path) {
+      res = get_child(res, p);
+      assert(res != nullidx);
+    }
+    return value_at(res);
+  }
+
+  bool has(std::initializer_list<key_type> &&path) {
+    auto res = nullidx;
+    for (auto p : path) {
+      res = get_child(res, p);
+      if (res == nullidx) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  value_type &create(std::initializer_list<key_type> &&path) {
+    auto res = nullidx;
+    for (auto p : path) {
+      res = create_child(res, p);
+    }
+
+    return value_at(res);
+  }
+
+  template <typename Path> value_type &create(const Path &path) {
+    auto res = nullidx;
+    for (auto &p : path) {
+      res = create_child(res, p);
+    }
+
+    return value_at(res);
+  }
+
+  // flags the node at `path`, created if missing; see muted()
+  template <typename Path> void set_muted(const Path &path, bool muted) {
+    auto n = nullidx;
+    for (auto &p : path) {
+      n = create_child(n, p);
+    }
+
+    if (n == nullidx) {
+      return;
+    }
+
+    at(n).flags = muted ? at(n).flags | muted_flag : at(n).flags & ~muted_flag;
+
+    // ancestors remember whether a filter lives below them, so that eviction
+    // of an idle ancestor does not take the filter along
+    for (auto p = at(n).parent; p != nullidx; p = at(p).parent) {
+      bool below = false;
+      for (auto c = at(p).child; c != nullidx && !below; c = at(c).sibling) {
+        below = at(c).flags & (muted_flag | muted_below_flag);
+      }
+      at(p).flags = below ? at(p).flags | muted_below_flag
+                          : at(p).flags & ~muted_below_flag;
+    }
+  }
+
+  // whether the node under the cursor is flagged, a single bit test meant to
+  // follow down()
+  bool muted() const {
+    return cursor != nullidx && (at(cursor).flags & muted_flag);
+  }
+
+  // children before their parents
+  template <typename F> void foreach (F &&func) {
+    postorder(root, true, [&func, this](unsigned, node_handle n) {
+      func(at(n).key, values[at(n).slot]);
+    });
+  }
+
+  template <typename F> void foreach_path(F &&func) {
+    std::vector<key_type> path;
+    visit([&func, &path, this](unsigned depth, node_handle n) {
+      path.resize(depth);
+      path.push_back(at(n).key);
+      func(path, values[at(n).slot]);
+    });
+  }
+
+  // visits nodes parents first, passing the node depth (0 for top level)
+  template <typename F> void foreach_preorder(F &&func) const {
+    visit([this, &func](unsigned depth, node_handle n) {
+      func(depth, at(n).key, values[at(n).slot]);
+    });
+  }
+
+  // func(slot, value) over the dense value storage, in slot order
+  template <typename F> void foreach_value(F &&func) { values.foreach (func); }
+
+  template <typename F> void foreach_value(F &&func) const {
+    values.foreach (func);
+  }
+
+  // number of value slots, an upper bound of slot(n) for every node
+  std::size_t value_slots() const { return values.size(); }
+
+  // read-only navigation; handles stay valid until the trie is modified
+  using node_handle = const node *;
+
+  // func(depth, handle), parents first; the walk follows child, sibling and
+  // parent links in a loop, so neither deep nor very wide tries grow the
+  // call stack
+  template <typename F> void visit(F &&func) const {
+    preorder(root, true, func);
+  }
+
+  // func(depth, handle), children first
+  template <typename F> void visit_postorder(F &&func) const {
+    postorder(root, true, func);
+  }
+
+  // visit() with the top-level subtrees spread over `threads` workers, each
+  // subtree walked parents first by a single worker; func runs concurrently
+  // and must only touch per-node state (e.g. a slot-indexed array). The trie
+  // must not be modified meanwhile.
+  template <typename F> void visit_parallel(unsigned threads, F &&func) const {
+    std::vector<index_type> tops;
+    for (auto n = root; n != nullidx; n = at(n).sibling) {
+      tops.push_back(n);
+    }
+
+    threads = std::min<unsigned>(threads, static_cast<unsigned>(tops.size()));
+    if (threads <= 1) {
+      return visit(func);
+    }
+
+    // subtrees vary wildly in size, so workers pick them one by one
+    std::atomic<std::size_t> next{0};
+    auto work = [&] {
+      for (auto i = next++; i < tops.size(); i = next++) {
+        preorder(tops[i], false, func);
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; ++i) {
+      workers.emplace_back(work);
+    }
+    work();
+    for (auto &w : workers) {
+      w.join();
+    }
+  }
+
+  node_handle first_root() const { return root; }
+
+  node_handle first_child(node_handle n) const { return at(n).child; }
+
+  node_handle next_sibling(node_handle n) const { return at(n).sibling; }
+
+  node_handle parent(node_handle n) const { return at(n).parent; }
+
+  const key_type &key(node_handle n) const { return at(n).key; }
+
+  const value_type &value(node_handle n) const { return values[at(n).slot]; }
+
+  std::size_t slot(node_handle n) const { return at(n).slot; }
+
+  // keys from the top-level node down to `n`
+  std::vector<key_type> path(node_handle n) const {
+    std::vector<key_type> res;
+    for (; n != nullidx; n = at(n).parent) {
+      res.push_back(at(n).key);
+    }
+    std::reverse(res.begin(), res.end());
+    return res;
+  }
+
+  unsigned depth() const { return trie_depth; }
+
+  // number of live nodes
+  std::size_t size() const { return pool.size(); }
+
+  // preallocates room for `nodes` more nodes and their values
+  void reserve(std::size_t nodes) {
+    pool.reserve(nodes);
+    values.reserve(
+        static_cast<typename value_store<value_type>::slot_type>(nodes));
+  }
+
+  // number of memory blocks the trie requested so far; stays put for as long
+  // as new nodes fit into reserved or released memory
+  std::size_t allocations() const { return pool.slabs() + values.chunks(); }
+
+  // bytes held by nodes and values, including reserved and released ones
+  std::size_t memory() const {
+    return pool.capacity() * sizeof(node) + values.memory();
+  }
+
+  uint32_t current_epoch() const { return epoch; }
+
+  // Closes the current epoch and removes every subtree whose top node was not
+  // entered during the last `idle_epochs` epochs (0 disables the check), or
+  // whose decayed hit rate fell below `min_rate` while it was not entered in
+  // the epoch just closed. The rate is updated as rate * decay + hits. Nodes
+  // on the cursor path are kept, so this is safe between start and stop.
+  // Freed nodes and value slots are reused by later insertions.
+  std::size_t evict(unsigned idle_epochs, double min_rate = 0,
+                    double decay = 0.5) {
+    for (auto n = cursor; n != nullidx; n = at(n).parent) {
+      at(n).flags |= active_flag;
+    }
+
+    const auto evicted = sweep(&root, idle_epochs, min_rate, decay);
+
+    for (auto n = cursor; n != nullidx; n = at(n).parent) {
+      at(n).flags &= ~active_flag;
+    }
+
+    ++epoch;
+    return evicted;
+  }
+
+  self_type clone() const {
+    self_type result;
+
+    clone_into(result);
+
+    return result;
+  }
+
+  self_type combine(const self_type &other) const {
+    self_type result;
+    clone_into(result);
+    other.clone_into(result);
+    return result;
+  }
+
+private:
+  struct node {
+    node *parent;
+    node *child;
+    node *sibling;
+    typename value_store<value_type>::slot_type slot;
+    uint32_t hits;       // down() calls in the current epoch
+    uint32_t last_epoch; // last epoch the node was entered (or created) in
+    float rate;          // hits per epoch, exponentially decayed
+    uint8_t flags;
+    key_type key;
+  };
+
+  static constexpr uint8_t active_flag = 1; // on the cursor path
+  static constexpr uint8_t muted_flag = 2;
+  static constexpr uint8_t muted_below_flag = 4; // a descendant is muted
+
+  using index_type = node *;
+  constexpr static index_type nullidx = nullptr;
+
+  value_type &value_at(index_type idx) { return values[at(idx).slot]; }
+
+  node &at(index_type idx) {
+    assert(idx != nullidx);
+    return *pool.at(idx);
+  }
+
+  const node &at(const node *idx) const {
+    assert(idx != nullidx);
+    return *pool.at(idx);
+  }
+
+  index_type new_node() { return new_node({}); }
+
+  index_type new_node(key_type key, index_type parent = nullidx) {
+    const auto index = pool.construct();
+    auto &node = at(index);
+    node.child = node.sibling = nullidx;
+    node.parent = parent;
+    node.key = key;
+    node.slot = values.alloc();
+    node.hits = 0;
+    node.last_epoch = epoch;
+    node.rate = 0;
+    node.flags = 0;
+    return index;
+  }
+
+  index_type get_child(index_type parent, key_type key) {
+    if (parent != nullidx) {
+      return find_child(parent, key);
+    } else {
+      auto res = root;
+      while (res != nullidx && key != at(res).key) {
+        res = res->sibling;
+      }
+      return res;
+    }
+
+    return nullidx;
+  }
+
+  index_type add_child(index_type p, key_type key) {
+    if (at(p).child != nullidx) {
+      p = guess_child(p, key);
+
+      if (at(p).key != key) {
+        auto sibling = new_node(key, at(p).parent);
+        at(p).sibling = sibling; // p may relocate
+        p = sibling;
+      }
+    } else {
+      auto child = new_node(key, p);
+      at(p).child = child; // p may relocate
+      p = child;
+    }
+    return p;
+  }
+
+  index_type create_child(index_type parent, key_type key) {
+    auto existing_child = get_child(parent, key);
+    if (existing_child != nullidx) {
+      return existing_child;
+    }
+
+    if (parent == nullidx) {
+      auto top = new_node(key);
+      at(top).sibling = root;
+      root = top;
+      return top;
+    }
+
+    return add_child(parent, key);
+  }
+
+  std::size_t sweep(index_type *link, unsigned idle_epochs, double min_rate,
+                    double decay) {
+    std::size_t evicted = 0;
+    while (*link != nullidx) {
+      auto &n = at(*link);
+      n.rate = static_cast<float>(n.rate * decay + n.hits);
+      if (n.hits) {
+        n.last_epoch = epoch;
+        n.hits = 0;
+      }
+
+      const auto idle = epoch - n.last_epoch;
+      const bool expired = idle_epochs && idle >= idle_epochs;
+      const bool cold = idle && n.rate < min_rate;
+      // muted nodes hold a filter, they and their ancestors are kept like
+      // the cursor path
+      constexpr uint8_t keep = active_flag | muted_flag | muted_below_flag;
+      if (!(n.flags & keep) && (expired || cold)) {
+        const auto top = *link;
+        *link = n.sibling;
+        evicted += release_subtree(top);
+      } else {
+        evicted += sweep(&n.child, idle_epochs, min_rate, decay);
+        link = &n.sibling;
+      }
+    }
+    return evicted;
+  }
+
+  // returns an unlinked subtree to the pool, same walk as destroy_nodes()
+  std::size_t release_subtree(index_type top) {
+    std::size_t count = 0;
+    auto n = top;
+    for (;;) {
+      if (at(n).child != nullidx) {
+        n = at(n).child;
+        continue;
+      }
+
+      index_type next = nullidx;
+      if (n != top) {
+        next = at(n).sibling;
+        if (next == nullidx) {
+          next = at(n).parent;
+          at(next).child = nullidx;
+        }
+      }
+
+      values.free(at(n).slot);
+      pool.destroy(n);
+      ++count;
+
+      if (n == top) {
+        return count;
+      }
+      n = next;
+    }
+  }
+
+  // runs node destructors (the pool releases the memory itself); walks the
+  // trie through parent links, so wide or deep tries need no extra stack
+  void destroy_nodes() noexcept {
+    if constexpr (!std::is_trivially_destructible<node>::value) {
+      auto n = root;
+      while (n != nullidx) {
+        if (at(n).child != nullidx) {
+          n = at(n).child;
+          continue;
+        }
+
+        auto next = at(n).sibling;
+        if (next == nullidx) {
+          // last child: the parent becomes a leaf
+          next = at(n).parent;
+          if (next != nullidx) {
+            at(next).child = nullidx;
+          }
+        }
+
+        pool.destroy(n);
+        n = next;
+      }
+    }
+
+    root = cursor = nullidx;
+    trie_depth = 0;
+  }
+
+  // walks the subtree of `top` (and the subtrees of its later siblings if
+  // `siblings` is set), depths are relative to `top`
+  template <typename F>
+  void preorder(index_type top, bool siblings, F &func) const {
+    auto n = top;
+    unsigned depth = 0;
+    while (n != nullidx) {
+      func(depth, node_handle(n));
+      if (at(n).child != nullidx) {
+        n = at(n).child;
+        ++depth;
+        continue;
+      }
+
+      while (n != nullidx) {
+        if (depth == 0 && !siblings) {
+          return;
+        }
+        if (at(n).sibling != nullidx) {
+          n = at(n).sibling;
+          break;
+        }
+        n = at(n).parent;
+        --depth;
+      }
+    }
+  }
+
+  template <typename F>
+  void postorder(index_type top, bool siblings, F &func) const {
+    auto n = top;
+    unsigned depth = 0;
+    while (n != nullidx) {
+      while (at(n).child != nullidx) {
+        n = at(n).child;
+        ++depth;
+      }
+
+      for (;;) {
+        func(depth, node_handle(n));
+        if (depth == 0 && !siblings) {
+          return;
+        }
+        if (at(n).sibling != nullidx) {
+          n = at(n).sibling;
+          break;
+        }
+        n = at(n).parent;
+        --depth;
+        if (n == nullidx) {
+          return;
+        }
+      }
+    }
+  }
+
+  void clone_into(self_type &result) const {
+    unsigned result_depth = 0;
+    visit([&](unsigned depth, node_handle n) {
+      for (; result_depth > depth; --result_depth) {
+        result.up();
+      }
+      measure::merge(result.down(at(n).key), values[at(n).slot]);
+      ++result_depth;
+    });
+
+    for (; result_depth > 0; --result_depth) {
+      result.up();
+    }
+  }
+
+  index_type find_child(index_type n, key_type key) {
+    auto child = at(n).child;
+    while (child != nullidx && at(child).key != key) {
+      child = at(child).sibling;
+    }
+
+    return child;
+  }
+
+  // finds a child or, if not present, its insertion place
+  // assumes there is at least one child
+  index_type guess_child(index_type n, key_type key) {
+    auto child = at(n).child;
+    assert(child != nullidx);
+
+    while (at(child).key != key && at(child).sibling != nullidx) {
+      child = at(child).sibling;
+    }
+
+    return child;
+  }
+
+  index_type cursor = nullidx;
+  index_type root = nullidx;
+  unsigned trie_depth = 0;
+  heap_pool<node> pool;
+  value_store<value_type> values;
+  uint32_t epoch = 0;
+};
+
+// non-owning view of a contiguous run of keys
+template <typename K> class path_span {
+public:
+  path_span(const K *data, std::size_t size) : _data(data), _size(size) {}
+
+  const K *begin() const { return _data; }
+  const K *end() const { return _data + _size; }
+  std::size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  const K &operator[](std::size_t i) const { return _data[i]; }
+  const K &back() const { return _data[_size - 1]; }
+
+private:
+  const K *_data;
+  std::size_t _size;
+};
+
+// Lazy DFS over a trie yielding (path, value) with the values as they are
+// stored, nothing is formatted. The path buffer belongs to the view and only
+// grows to the deepest path, so a view kept around and iterated again (e.g.
+// by a periodic check) does not allocate. One iteration at a time per view;
+// entries are valid until the iterator moves on.
+template <typename Trie> class report_view {
+public:
+  using key_type = typename Trie::key_type;
+  using value_type = typename Trie::value_type;
+  using node_handle = typename Trie::node_handle;
+
+  struct entry {
+    path_span<key_type> path;
+    const value_type &value;
+
+    unsigned depth() const { return static_cast<unsigned>(path.size() - 1); }
+    const key_type &key() const { return path.back(); }
+  };
+
+  class iterator {
+  public:
+    entry operator*() const {
+      return {path_span<key_type>(_view->_path.data(), _depth + 1),
+              _view->_trie->value(_node)};
+    }
+
+    iterator &operator++() {
+      auto &t = *_view->_trie;
+      if (auto child = t.first_child(_node)) {
+        ++_depth;
+        enter(child);
+        return *this;
+      }
+
+      while (_node && !t.next_sibling(_node)) {
+        _node = t.parent(_node);
+        --_depth;
+      }
+
+      if (_node) {
+        enter(t.next_sibling(_node));
+      }
+      return *this;
+    }
+
+    bool operator==(const iterator &other) const { return _node == other._node; }
+    bool operator!=(const iterator &other) const { return _node != other._node; }
+
+  private:
+    friend class report_view;
+
+    iterator(report_view *view, node_handle node) : _view(view) {
+      if (node) {
+        enter(node);
+      }
+    }
+
+    void enter(node_handle n) {
+      _node = n;
+      auto &path = _view->_path;
+      const auto &key = _view->_trie->key(n);
+      if (path.size() > _depth) {
+        path[_depth] = key;
+      } else {
+        path.push_back(key);
+      }
+    }
+
+    report_view *_view;
+    node_handle _node = nullptr;
+    unsigned _depth = 0;
+  };
+
+  explicit report_view(const Trie &trie) : _trie(&trie) {}
+
+  iterator begin() { return iterator(this, _trie->first_root()); }
+  iterator end() { return iterator(this, nullptr); }
+
+  // func(path, value) for every node, parents first
+  template <typename F> void foreach (F &&func) {
+    for (auto e : *this) {
+      func(e.path, e.value);
+    }
+  }
+
+private:
+  const Trie *_trie;
+  std::vector<key_type> _path;
+};
+
+// A string interned into a key_arena. Keys from the same arena are equal only
+// if they are the same string, so equality compares pointers; ordering and
+// printing use the text.
+class interned_key {
+public:
+  interned_key() = default;
+
+  std::string_view view() const { return {_data, _size}; }
+
+  const char *c_str() const { return _data ? _data : ""; }
+
+  operator std::string_view() const { return view(); }
+
+  operator std::string() const { return std::string(view()); }
+
+  bool operator==(const interned_key &other) const {
+    return _data == other._data;
+  }
+
+  bool operator!=(const interned_key &other) const {
+    return _data != other._data;
+  }
+
+  bool operator<(const interned_key &other) const {
+    return view() < other.view();
+  }
+
+  friend std::ostream &operator<<(std::ostream &stream,
+                                  const interned_key &key) {
+    return stream << key.view();
+  }
+
+private:
+  interned_key(const char *data, uint32_t size) : _data(data), _size(size) {}
+
+  const char *_data = nullptr;
+  uint32_t _size = 0;
+
+  friend class key_arena;
 };
 
-// TODO:
-// 1. limit stack depth
-// 2. limit number of metrics stored
-// 3. contiguos object pool
-// 4. make trie copy-able
-// 5. perfect forwarding of functor args (lambdas)
-// 6. better sampling options: medians?
-template <typename K, typename V, int N = 254> class trie {
+// Owns the text of interned keys. Strings are copied once, NUL-terminated,
+// into large chunks and never move, so keys stay valid as long as the arena,
+// or until release() drops them. Pinned keys are never dropped.
+class key_arena {
 public:
-  using key_type = K;
-  using value_type = V;
-  using self_type = trie<K, V, N>;
+  key_arena() = default;
+  key_arena(const key_arena &) = delete;
+  key_arena &operator=(const key_arena &) = delete;
+
+  interned_key intern(std::string_view text, bool pin = false) {
+    auto i = _index.find(text);
+    if (i == _index.end()) {
+      i = _index.insert(store(text)).first;
+    }
+    if (pin) {
+      _pinned.insert(i->data());
+    }
+    return interned_key(i->data(), static_cast<uint32_t>(i->size()));
+  }
+
+  // Forgets the keys that are neither pinned nor `live(data)` and frees the
+  // chunks left without any key. Surviving keys do not move; dead text that
+  // shares a chunk with a survivor stays until that chunk is freed.
+  template <typename Live> void release(Live &&live) {
+    for (auto i = _index.begin(); i != _index.end();) {
+      if (_pinned.count(i->data()) || live(i->data())) {
+        ++i;
+      } else {
+        i = _index.erase(i);
+      }
+    }
+    if (_chunks.empty()) {
+      return;
+    }
+
+    std::vector<std::pair<const char *, std::size_t>> starts;
+    for (std::size_t i = 0; i < _chunks.size(); ++i) {
+      starts.emplace_back(_chunks[i].data.get(), i);
+    }
+    std::sort(starts.begin(), starts.end(), [](const auto &a, const auto &b) {
+      return std::less<const char *>()(a.first, b.first);
+    });
+
+    // the last chunk is still being filled
+    std::vector<bool> used(_chunks.size());
+    used.back() = true;
+    for (auto &key : _index) {
+      auto i = std::upper_bound(
+          starts.begin(), starts.end(), key.data(),
+          [](const char *data, const auto &start) {
+            return std::less<const char *>()(data, start.first);
+          });
+      used[std::prev(i)->second] = true;
+    }
 
-  ~trie() { /* foreach_node(root, [](auto n){ delete n; }); */
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < _chunks.size(); ++i) {
+      if (used[i]) {
+        _chunks[kept++] = std::move(_chunks[i]);
+      } else {
+        _memory -= _chunks[i].size;
+      }
+    }
+    _chunks.resize(kept);
   }
 
-  trie() = default;
-  trie(trie &&) = default;
-  trie &operator=(trie &&) = default;
+  std::size_t size() const { return _index.size(); }
 
-  trie(const trie &) = delete;
-  trie &operator=(const trie &) = delete;
+  // chunks plus index entries, every new key costs at least one
+  std::size_t allocations() const { return _chunks.size() + _index.size(); }
 
-  value_type &up() {
-    assert(cursor != nullidx);
-    assert(trie_depth > 0);
+  // bytes of key text chunks, the index not included
+  std::size_t memory() const { return _memory; }
 
-    auto &res = at(cursor).value;
-    cursor = at(cursor).parent;
-    --trie_depth;
+private:
+  static constexpr std::size_t chunk_size = 4096;
+
+  std::string_view store(std::string_view text) {
+    const auto need = text.size() + 1;
+    if (_used + need > _capacity) {
+      _capacity = std::max(chunk_size, need);
+      _chunks.push_back(
+          {std::unique_ptr<char[]>(new char[_capacity]), _capacity});
+      _memory += _capacity;
+      _used = 0;
+    }
+
+    char *dst = _chunks.back().data.get() + _used;
+    std::copy(text.begin(), text.end(), dst);
+    dst[text.size()] = '\0';
+    _used += need;
+    return {dst, text.size()};
+  }
+
+  struct chunk {
+    std::unique_ptr<char[]> data;
+    std::size_t size;
+  };
+
+  std::vector<chunk> _chunks;
+  std::size_t _used = 0;
+  std::size_t _capacity = 0;
+  std::size_t _memory = 0;
+  std::unordered_set<std::string_view> _index;
+  std::unordered_set<const char *> _pinned;
+};
+
+// How a monitor stores keys of type T in its trie (stored_type) and how it
+// hands them back in reports and query results (owned_type).
+template <typename T> struct key_traits {
+  using stored_type = T;
+  using owned_type = T;
+};
+
+// string_view keys are interned into a monitor-owned arena: no strings are
+// allocated after warm-up, and trie lookups compare pointers
+template <> struct key_traits<std::string_view> {
+  using stored_type = interned_key;
+  using owned_type = std::string;
+};
+
+enum class report_type : int {
+  averages,
+  calls,
+  percentages,
+  totals,
+  full,
+  details
+};
+
+// what monitor::top_k ranks paths by; self is total minus the children totals
+enum class top_metric : int { total, self, average, calls };
+
+template <typename T, typename Timer = aggregate_timer> class monitor {
+public:
+  using key_type = T;
+  using stored_key = typename key_traits<T>::stored_type;
+  using owned_key = typename key_traits<T>::owned_type;
+  using report_t = tree<owned_key, std::string>;
+  using timer_type = Timer;
+  using storage_type = trie<stored_key, timer_type>;
+
+  static constexpr bool interns_keys = !std::is_same<T, stored_key>::value;
+
+  class metric {
+  public:
+    metric() {}
+
+    ~metric() { stop(); }
+
+    void stop() {
+      if (_mon) {
+        _mon->stop();
+      }
+      _mon = nullptr;
+    }
+
+    metric(const metric &) = delete;
+    metric &operator=(const metric &) = delete;
+
+    metric(metric &&other) { *this = std::move(other); }
+
+    metric &operator=(metric &&other) {
+      stop();
+      _mon = other._mon;
+
+      other._mon = nullptr;
+      return *this;
+    }
+
+  private:
+    explicit metric(monitor &mon) : _mon(&mon) {}
+
+    monitor *_mon = nullptr;
+
+    friend class monitor;
+  };
+
+  // keys are only interned once the scope is known to be recorded, so a
+  // disabled or sampled-out monitor never touches its arena
+  void start(T id) {
+    if (admit()) {
+      record(key_of(id));
+    }
+  }
+
+  // keys interned up front skip the arena lookup on every start
+  template <typename K, typename = std::enable_if_t<
+                            interns_keys && std::is_same<K, stored_key>::value>>
+  void start(K id) {
+    enter(id);
+  }
+
+  // the key stays valid for the monitor's lifetime, evict() keeps it
+  stored_key intern(std::string_view text) {
+    return arena().intern(text, true);
+  }
+
+  void enter(stored_key id) {
+    if (admit()) {
+      record(id);
+    }
+  }
+
+  void record(stored_key id) {
+    if (filters_ && filters_->dirty.load(std::memory_order_acquire)) {
+      apply_filters();
+    }
+
+    auto &val = trie_.down(id);
+    if (trie_.muted()) {
+      // the scope and whatever starts inside it are swallowed like scopes
+      // of a disabled monitor, without reading the clock
+      trie_.up();
+      ++gate_;
+      return;
+    }
+    val.start();
+  }
+
+  void stop() {
+    if (gate_ & muted_mask) {
+      --gate_;
+      return;
+    }
+
+    if (sample_start_ == 0 && (trie_.depth() > 0 || sample_limit_ > 0)) {
+      trie_.up().stop();
+    }
+
+#ifdef MEASURE_CHECK_WARM
+    assert(cold_allocations() == 0 && "path allocated after mark_warm()");
+#endif
+  }
+
+  void proceed(T id) {
+    stop();
+    start(id);
+  }
+
+  // Turns recording off (mute) or back on (unmute) for the subtree at `path`,
+  // e.g. to zoom into one subsystem. Scopes in a muted subtree cost a node
+  // lookup and a bit test, no clock reads, and start/stop stay balanced.
+  // Callable from any thread: requests are queued and applied by the
+  // recording thread at its next recorded start(), at any depth; scopes
+  // already open when a filter is applied are not affected.
+  void mute(std::vector<owned_key> path) { request_filter(std::move(path), true); }
+
+  void unmute(std::vector<owned_key> path) {
+    request_filter(std::move(path), false);
+  }
+
+  // add to the counters of the innermost open scope, no key lookup involved;
+  // the timer type needs count()/add_bytes() members, see throughput_timer.
+  // Ignored when that scope is not recorded (disabled or not sampled).
+  void count(unsigned long long items = 1) {
+    if (auto val = current()) {
+      val->count(items);
+    }
+  }
+
+  void add_bytes(unsigned long long bytes) {
+    if (auto val = current()) {
+      val->add_bytes(bytes);
+    }
+  }
+
+  metric scope(T id) {
+    start(id);
+    return metric(*this);
+  }
+
+  template <typename K, typename = std::enable_if_t<
+                            interns_keys && std::is_same<K, stored_key>::value>>
+  metric scope(K id) {
+    enter(id);
+    return metric(*this);
+  }
+
+  metric operator()(T id) { return scope(id); }
+
+  // `threads` > 1 formats the top-level subtrees on that many threads
+  report_t report(report_type type = report_type::averages,
+                  unsigned threads = 1) {
+    // the figures are computed in one dense pass over the counters, only the
+    // formatting below walks the trie topology
+    std::vector<double> figures;
+    if (type == report_type::averages) {
+      figures.resize(trie_.value_slots());
+      trie_.foreach_value([&figures](std::size_t i, const timer_type &val) {
+        figures[i] = val.avg();
+      });
+    } else if (type == report_type::percentages ||
+               type == report_type::full) {
+      uint64_t total_time = 0;
+      for (auto n = trie_.first_root(); n; n = trie_.next_sibling(n)) {
+        total_time += trie_.value(n).elapsed();
+      }
+
+      figures.resize(trie_.value_slots());
+      const double total = total_time;
+      trie_.foreach_value([&figures, total](std::size_t i,
+                                            const timer_type &val) {
+        figures[i] = val.elapsed() / total * 100;
+      });
+    }
+
+    report_t res;
+    std::vector<stored_key> path;
+    auto insert = [&](unsigned depth, typename storage_type::node_handle n,
+                      std::string text) {
+      path.resize(depth);
+      path.push_back(trie_.key(n));
+      res[path] = std::move(text);
+    };
+
+    if (threads <= 1) {
+      trie_.visit([&](unsigned depth, typename storage_type::node_handle n) {
+        insert(depth, n, format(type, trie_.value(n), figure(figures, n)));
+      });
+      return res;
+    }
+
+    // formatting is the expensive part: workers fill one string per slot,
+    // then the report tree is built on this thread
+    std::vector<std::string> text(trie_.value_slots());
+    trie_.visit_parallel(
+        threads, [&](unsigned, typename storage_type::node_handle n) {
+          text[trie_.slot(n)] =
+              format(type, trie_.value(n), figure(figures, n));
+        });
+    trie_.visit([&](unsigned depth, typename storage_type::node_handle n) {
+      insert(depth, n, std::move(text[trie_.slot(n)]));
+    });
     return res;
   }
 
-  template <typename F> void up(F &&value_func) {
-    assert(cursor != nullidx);
-    assert(trie_depth > 0);
+  // zeroes every counter and keeps the recorded paths, e.g. at the start of
+  // a reporting interval; no scope may be open
+  void reset() {
+    assert(trie_.depth() == 0);
+    trie_.foreach_value([](std::size_t, timer_type &val) { val = timer_type(); });
+  }
+
+  // multiplies every counter by `factor`, e.g. to decay old intervals; the
+  // timer type needs a scale(double) member; no scope may be open
+  void scale(double factor) {
+    assert(trie_.depth() == 0);
+    trie_.foreach_value(
+        [factor](std::size_t, timer_type &val) { val.scale(factor); });
+  }
+
+  // drops paths that went cold, see trie::evict(); call once per reporting
+  // interval in long-running processes so that paths keyed by transient ids
+  // do not grow the monitor forever; open scopes are kept. Interned keys no
+  // longer used by any path are released too, except the ones returned by
+  // intern().
+  std::size_t evict(unsigned idle_epochs, double min_rate = 0,
+                    double decay = 0.5) {
+    const auto evicted = trie_.evict(idle_epochs, min_rate, decay);
+    if constexpr (interns_keys) {
+      if (evicted && arena_) {
+        std::unordered_set<const char *> live;
+        trie_.visit([&](unsigned, typename storage_type::node_handle n) {
+          live.insert(trie_.key(n).view().data());
+        });
+        arena_->release([&](const char *data) { return live.count(data); });
+      }
+    }
+    return evicted;
+  }
 
-    at(cursor).value = value_func(at(cursor).value);
-    cursor = at(cursor).parent;
-    --trie_depth;
+  // number of recorded paths (trie nodes)
+  std::size_t size() const { return trie_.size(); }
+
+  // approximate bytes held by the recorded paths and interned keys
+  std::size_t memory() const {
+    return trie_.memory() + (arena_ ? arena_->memory() : 0);
   }
 
-  value_type &down(key_type key) {
-    if (cursor != nullidx) {
-      cursor = add_child(cursor, key);
-    } else {
-      cursor = root;
-      while (cursor != nullidx && key != at(cursor).key) {
-        cursor = cursor->sibling;
+  // preallocates memory for `nodes` more paths, so that entering them for the
+  // first time does not malloc on a latency-critical request
+  void reserve(std::size_t nodes) { trie_.reserve(nodes); }
+
+  // creates the given paths up front with empty counters, e.g. at startup:
+  //   mon.prewarm({{"request", "parse"}, {"request", "db"}});
+  void prewarm(std::initializer_list<std::vector<T>> paths) {
+    for (auto &path : paths) {
+      create(path);
+    }
+  }
+
+  // remembers the current allocation count; cold_allocations() then tells
+  // how many allocations recording needed since, and with MEASURE_CHECK_WARM
+  // defined stop() asserts that there were none
+  void mark_warm() { warm_mark_ = allocations(); }
+
+  std::size_t cold_allocations() const {
+    return warm_mark_ == no_mark ? 0 : allocations() - warm_mark_;
+  }
+
+  template <typename F> void foreach (F &&f) {
+    // TODO perfect forwarding for f
+    trie_.foreach (
+        [&f](T key, timer_type &val) { f(key, val.elapsed(), val.calls()); });
+  }
+
+  // f(path, elapsed, calls) for every node, parents first; the path is a
+  // path_span of stored keys, valid during the call
+  template <typename F> void foreach_path(F &&f) const {
+    for (auto e : view()) {
+      f(e.path, e.value.elapsed(), e.value.calls());
+    }
+  }
+
+  using view_type = report_view<storage_type>;
+
+  // typed, allocation-free alternative to report(): iterates the recorded
+  // paths with their timers, formatting is up to the caller
+  view_type view() const { return view_type(trie_); }
+
+  std::string report_json(report_type type = report_type::averages) {
+    return to_json(report(type));
+  }
+
+  struct hot_path {
+    std::vector<owned_key> path;
+    double value;
+    timer_type timer;
+  };
+
+  // the `k` highest ranked paths, best first, in one pass over the trie using
+  // a bounded heap; only the winning paths are materialized
+  std::vector<hot_path> top_k(std::size_t k,
+                              top_metric metric = top_metric::total,
+                              double min_value = 0,
+                              unsigned long min_calls = 0) const {
+    using handle = typename trie_type::node_handle;
+    using entry = std::pair<double, handle>;
+    auto greater = [](const entry &a, const entry &b) {
+      return a.first > b.first;
+    };
+
+    if (k == 0) {
+      return {};
+    }
+
+    std::vector<entry> heap;
+    heap.reserve(std::min(k, trie_.size()));
+
+    trie_.visit([&](unsigned, handle n) {
+      auto &val = trie_.value(n);
+      if (val.calls() < min_calls) {
+        return;
       }
 
-      if (cursor == nullidx) {
-        cursor = new_node(key);
-        cursor->sibling = root;
-        root = cursor;
+      const double rank = rank_of(n, metric);
+      if (rank < min_value) {
+        return;
+      }
+
+      if (heap.size() < k) {
+        heap.emplace_back(rank, n);
+        std::push_heap(heap.begin(), heap.end(), greater);
+      } else if (rank > heap.front().first) {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        heap.back() = entry(rank, n);
+        std::push_heap(heap.begin(), heap.end(), greater);
+      }
+    });
+
+    std::sort_heap(heap.begin(), heap.end(), greater);
+
+    std::vector<hot_path> res;
+    res.reserve(heap.size());
+    for (auto &e : heap) {
+      const auto path = trie_.path(e.second);
+      res.push_back({{path.begin(), path.end()}, e.first, trie_.value(e.second)});
+    }
+    return res;
+  }
+
+  // f(depth, key, timer) for every node, parents before children; values of
+  // scopes that are still open are not meaningful
+  template <typename F> void foreach_preorder(F &&f) const {
+    trie_.foreach_preorder(f);
+  }
+
+  unsigned depth() const { return trie_.depth(); }
+
+  // read-only access to the recorded trie, for passes outside the monitor
+  const storage_type &storage() const { return trie_; }
+
+  // scopes started while disabled are never recorded, even if the monitor is
+  // re-enabled before they stop, so start/stop pairs always stay balanced
+  void enable() { gate_ &= muted_mask; }
+
+  void disable() { gate_ |= disabled_flag; }
+
+  bool enabled() const { return !(gate_ & disabled_flag); }
+
+  void stop_sampling_after(unsigned samples_num) {
+    sample_limit_ = samples_num;
+  }
+
+  void start_sampling_after(unsigned samples_num) {
+    sample_start_ = samples_num + 1;
+  }
+
+  // folds `val` into the node at `path`, creating it if needed
+  template <typename Path> void add(const Path &path, const timer_type &val) {
+    measure::merge(create(path), val);
+  }
+
+  // Interned keys are copied into the result's own arena, so the result can
+  // be used on another thread than the source, which keeps interning.
+  monitor clone() const {
+    monitor result;
+    if constexpr (interns_keys) {
+      result.fold(*this);
+    } else {
+      result.trie_ = std::move(trie_.clone());
+    }
+    return result;
+  }
+
+  monitor combine(const monitor &other) const {
+    if constexpr (interns_keys) {
+      monitor result = clone();
+      result.fold(other);
+      return result;
+    } else {
+      monitor result;
+      result.trie_ = std::move(trie_.combine(other.trie_));
+      return result;
+    }
+  }
+
+private:
+  using trie_type = storage_type;
+
+  // whether a start() is recorded, the disabled path is a single branch
+  bool admit() {
+    if (gate_) {
+      // disabled: only remember how many stop() calls to swallow
+      ++gate_;
+      return false;
+    }
+
+    if (trie_.depth() > 0) {
+      return true;
+    }
+
+    if (sample_start_ > 0) {
+      if (--sample_start_) {
+        return false;
       }
     }
 
-    ++trie_depth;
-    return at(cursor).value;
+    if (sample_limit_ > 0) {
+      --sample_limit_;
+      return true;
+    }
+    return false;
   }
 
-  template <typename F> void down(key_type key, F &&value_func) {
-    down(key);
-    at(cursor).value = value_func(at(cursor).value);
+  key_arena &arena() {
+    if (!arena_) {
+      arena_ = std::make_unique<key_arena>();
+    }
+    return *arena_;
   }
 
-  value_type &get() {
-    assert(cursor != nullidx);
-    return at(cursor).value;
+  // re-interns the keys of `other` into this monitor's arena
+  void fold(const monitor &other) {
+    std::vector<stored_key> path;
+    other.trie_.visit(
+        [&](unsigned depth, typename storage_type::node_handle n) {
+          path.resize(depth);
+          path.push_back(arena().intern(other.trie_.key(n)));
+          measure::merge(trie_.create(path), other.trie_.value(n));
+        });
   }
 
-  value_type &at(std::initializer_list<key_type> &&path) {
-    auto res = nullidx;
-    for (auto p : path) {
-      res = get_child(res, p);
-      assert(res != nullidx);
+  stored_key key_of(const T &id) {
+    if constexpr (interns_keys) {
+      return arena().intern(id);
+    } else {
+      return id;
     }
-    return at(res).value;
   }
 
-  bool has(std::initializer_list<key_type> &&path) {
-    auto res = nullidx;
-    for (auto p : path) {
-      res = get_child(res, p);
-      if (res == nullidx) {
-        return false;
-      }
-    }
-    return true;
+  void request_filter(std::vector<owned_key> path, bool muted) {
+    std::lock_guard<std::mutex> lock(filters_->mutex);
+    filters_->pending.emplace_back(std::move(path), muted);
+    filters_->dirty.store(true, std::memory_order_release);
   }
 
-  value_type &create(std::initializer_list<key_type> &&path) {
-    auto res = nullidx;
-    for (auto p : path) {
-      res = create_child(res, p);
+  void apply_filters() {
+    decltype(filters_->pending) pending;
+    {
+      std::lock_guard<std::mutex> lock(filters_->mutex);
+      pending.swap(filters_->pending);
+      filters_->dirty.store(false, std::memory_order_relaxed);
     }
 
-    return at(res).value;
+    for (auto &filter : pending) {
+      std::vector<stored_key> keys;
+      for (auto &k : filter.first) {
+        keys.push_back(key_of(k));
+      }
+      trie_.set_muted(keys, filter.second);
+    }
   }
 
-  template <typename F> void foreach (F &&func) {
-    foreach_node(root, [&func, this](index_type node) {
-      func(at(node).key, at(node).value);
-    });
+  timer_type *current() {
+    return (gate_ & muted_mask) || trie_.depth() == 0 ? nullptr : &trie_.get();
   }
 
-  template <typename F> void foreach_path(F &&func) {
-    foreach_node(root, [&func, this](index_type node) {
-      auto root = node;
-      std::vector<key_type> path;
-      path.push_back(node->key);
-      while (node->parent) {
-        node = node->parent;
-        path.insert(path.begin(), node->key);
+  template <typename Path> timer_type &create(const Path &path) {
+    if constexpr (interns_keys) {
+      std::vector<stored_key> keys;
+      for (auto &k : path) {
+        keys.push_back(key_of(k));
       }
+      return trie_.create(keys);
+    } else {
+      return trie_.create(path);
+    }
+  }
 
-      func(path, at(root).value);
-    });
+  std::size_t allocations() const {
+    return trie_.allocations() + (arena_ ? arena_->allocations() : 0);
   }
 
-  unsigned depth() const { return trie_depth; }
+  static constexpr unsigned disabled_flag = 0x80000000;
+  static constexpr unsigned muted_mask = ~disabled_flag;
+  static constexpr std::size_t no_mark = std::numeric_limits<std::size_t>::max();
 
-  self_type clone() const {
-    self_type result;
+  double rank_of(typename trie_type::node_handle n, top_metric metric) const {
+    auto &val = trie_.value(n);
+    switch (metric) {
+    case top_metric::self: {
+      double children = 0;
+      for (auto c = trie_.first_child(n); c; c = trie_.next_sibling(c)) {
+        children += trie_.value(c).elapsed();
+      }
+      return std::max(0.0, val.elapsed() - children);
+    }
+    case top_metric::average:
+      return val.avg();
+    case top_metric::calls:
+      return val.calls();
+    case top_metric::total:
+    default:
+      return val.elapsed();
+    }
+  }
 
-    recursive_clone(result, root);
+  // declared before the trie, whose keys may point into it; never shared
+  // between monitors, the arena is not synchronized
+  std::unique_ptr<key_arena> arena_;
+  trie_type trie_;
+  // disabled flag in the high bit, number of muted open scopes below it
+  unsigned gate_ = 0;
+  unsigned sample_limit_ = 0xffffffff;
+  unsigned sample_start_ = 1;
+  std::size_t warm_mark_ = no_mark;
 
-    return result;
+  // mute/unmute requests from other threads, see mute()
+  struct filter_queue {
+    std::mutex mutex;
+    std::vector<std::pair<std::vector<owned_key>, bool>> pending;
+    std::atomic<bool> dirty{false};
+  };
+  std::unique_ptr<filter_queue> filters_ = std::make_unique<filter_queue>();
+
+  double figure(const std::vector<double> &figures,
+                typename storage_type::node_handle n) const {
+    return figures.empty() ? 0 : figures[trie_.slot(n)];
+  }
+
+  static std::string format(report_type type, const timer_type &val,
+                            double figure) {
+    switch (type) {
+    case report_type::averages:
+      return str(figure);
+    case report_type::calls:
+      return str(val.calls());
+    case report_type::totals:
+      return str(val.elapsed());
+    case report_type::percentages:
+      return str(figure) + "%";
+    case report_type::full: {
+      std::stringstream ss;
+      ss << figure << "% [" << val.elapsed() << "/ " << val.calls() << " = "
+         << val.avg() << " us]";
+      std::stringstream details;
+      describe(details, val);
+      if (details.tellp() > 0) {
+        ss << ' ' << details.str();
+      }
+      return ss.str();
+    }
+    case report_type::details: {
+      std::stringstream ss;
+      describe(ss, val);
+      return ss.str();
+    }
+    default:
+      return "";
+    }
   }
 
-  self_type combine(const self_type &other) const {
-    self_type result;
-    recursive_clone(result, root);
-    other.recursive_clone(result, other.root);
-    return result;
+  template <typename Type> static std::string str(Type &&t) {
+    std::stringstream ss;
+    ss << t;
+    return ss.str();
   }
+};
 
-private:
-  struct node {
-    node *parent;
-    node *child;
-    node *sibling;
-    key_type key;
-    value_type value;
-  };
+// writes folded stacks ("a;b;c <self usec>" per line), the input format of
+// flame graph tools; nodes without self time are skipped
+template <typename T, typename Timer>
+void write_folded(std::ostream &stream, const monitor<T, Timer> &mon) {
+  using storage_type = typename monitor<T, Timer>::storage_type;
+  auto &data = mon.storage();
+  std::vector<typename storage_type::key_type> path;
+  data.visit([&](unsigned depth, typename storage_type::node_handle n) {
+    path.resize(depth);
+    path.push_back(data.key(n));
+
+    auto self = (double)data.value(n).elapsed();
+    for (auto c = data.first_child(n); c; c = data.next_sibling(c)) {
+      self -= data.value(c).elapsed();
+    }
+    if (self <= 0) {
+      return;
+    }
 
-  using index_type = node *;
-  constexpr static index_type nullidx = nullptr;
+    for (std::size_t i = 0; i < path.size(); ++i) {
+      stream << (i ? ";" : "") << path[i];
+    }
+    stream << ' ' << (unsigned long long)self << '\n';
+  });
+}
 
-  node &at(index_type idx) {
-    assert(idx != nullidx);
-    return *pool.at(idx);
-  }
+enum class path_change : int { changed, added, removed };
 
-  const node &at(index_type idx) const {
-    assert(idx != nullidx);
-    return *pool.at(idx);
-  }
+// per-path difference between two monitor snapshots
+template <typename T> struct path_delta {
+  struct figures {
+    double total = 0;
+    double calls = 0;
+    double avg = 0;
+  };
 
-  index_type new_node() { return new_node({}); }
+  std::vector<T> path;
+  path_change change;
+  figures before;
+  figures after;
 
-  index_type new_node(key_type key, index_type parent = nullidx) {
-    const auto index = pool.construct();
-    auto &node = at(index);
-    node.child = node.sibling = nullidx;
-    node.parent = parent;
-    node.key = key;
-    return index;
-  }
+  double total_delta() const { return after.total - before.total; }
+  double calls_delta() const { return after.calls - before.calls; }
+  double avg_delta() const { return after.avg - before.avg; }
 
-  index_type get_child(index_type parent, key_type key) {
-    if (parent != nullidx) {
-      return find_child(parent, key);
-    } else {
-      auto res = root;
-      while (res != nullidx && key != at(res).key) {
-        res = res->sibling;
-      }
-      return res;
-    }
+  // after / before, infinity for paths that were not recorded before
+  double total_ratio() const { return ratio(before.total, after.total); }
+  double calls_ratio() const { return ratio(before.calls, after.calls); }
+  double avg_ratio() const { return ratio(before.avg, after.avg); }
 
-    return nullidx;
+private:
+  static double ratio(double before, double after) {
+    if (before == 0) {
+      return after == 0 ? 1 : std::numeric_limits<double>::infinity();
+    }
+    return after / before;
   }
+};
 
-  index_type add_child(index_type p, key_type key) {
-    if (at(p).child != nullidx) {
-      p = guess_child(p, key);
+namespace detail {
+template <typename Trie, typename Key> class differ {
+public:
+  using key_type = Key;
+  using handle = typename Trie::node_handle;
+  using delta = path_delta<key_type>;
 
-      if (at(p).key != key) {
-        auto sibling = new_node(key, at(p).parent);
-        at(p).sibling = sibling; // p may relocate
-        p = sibling;
+  differ(const Trie &before, const Trie &after, double noise)
+      : _before(before), _after(after), _noise(noise) {}
+
+  std::vector<delta> run() {
+    walk(_before.first_root(), _after.first_root());
+    return std::move(_out);
+  }
+
+private:
+  // matches two sibling lists by key, then recurses into matched pairs
+  void walk(handle before_first, handle after_first) {
+    auto lhs = siblings(_before, before_first);
+    auto rhs = siblings(_after, after_first);
+
+    auto l = lhs.begin();
+    auto r = rhs.begin();
+    while (l != lhs.end() || r != rhs.end()) {
+      if (r == rhs.end() ||
+          (l != lhs.end() && _before.key(*l) < _after.key(*r))) {
+        one_sided(_before, *l++, path_change::removed);
+      } else if (l == lhs.end() || _after.key(*r) < _before.key(*l)) {
+        one_sided(_after, *r++, path_change::added);
+      } else {
+        _path.push_back(_after.key(*r));
+        compare(*l, *r);
+        walk(_before.first_child(*l), _after.first_child(*r));
+        _path.pop_back();
+        ++l;
+        ++r;
       }
-    } else {
-      auto child = new_node(key, p);
-      at(p).child = child; // p may relocate
-      p = child;
     }
-    return p;
   }
 
-  index_type create_child(index_type parent, key_type key) {
-    if (parent == nullidx) {
-      assert(root == nullidx);
-      root = new_node();
-      at(root).key = key;
-      return root;
-    } else {
-      auto existing_child = get_child(parent, key);
-      return existing_child != nullidx ? existing_child
-                                       : add_child(parent, key);
+  void compare(handle before, handle after) {
+    delta d{_path, path_change::changed, figures_of(_before.value(before)),
+            figures_of(_after.value(after))};
+    if (noticeable(d.before.total, d.after.total) ||
+        noticeable(d.before.calls, d.after.calls) ||
+        noticeable(d.before.avg, d.after.avg)) {
+      _out.push_back(std::move(d));
     }
   }
 
-  template <typename F> void foreach_node(index_type p, F &&func) {
-    if (p != nullidx) {
-      foreach_node(at(p).child, std::forward<decltype(func)>(func));
-      foreach_node(at(p).sibling, std::forward<decltype(func)>(func));
+  // reports a node present in one snapshot only, with all of its subtree
+  void one_sided(const Trie &trie, handle n, path_change change) {
+    _path.push_back(trie.key(n));
 
-      std::forward<decltype(func)>(func)(p);
+    delta d{_path, change, {}, {}};
+    (change == path_change::added ? d.after : d.before) =
+        figures_of(trie.value(n));
+    _out.push_back(std::move(d));
+
+    for (auto c = trie.first_child(n); c; c = trie.next_sibling(c)) {
+      one_sided(trie, c, change);
     }
+
+    _path.pop_back();
   }
 
-  void recursive_clone(self_type &result, index_type p) const {
-    if (p != nullidx) {
-      // TODO what if operator += is not defined? use templates to fix this
-      result.down(at(p).key) += at(p).value;
+  bool noticeable(double before, double after) const {
+    const auto base = std::max(std::abs(before), std::abs(after));
+    return base != 0 && std::abs(after - before) > _noise * base;
+  }
 
-      recursive_clone(result, at(p).child);
-      result.up();
-      recursive_clone(result, at(p).sibling);
-    }
+  template <typename V>
+  static typename delta::figures figures_of(const V &val) {
+    return {(double)val.elapsed(), (double)val.calls(), val.avg()};
   }
 
-  index_type find_child(index_type n, key_type key) {
-    auto child = at(n).child;
-    while (child != nullidx && at(child).key != key) {
-      child = at(child).sibling;
+  static std::vector<handle> siblings(const Trie &trie, handle first) {
+    std::vector<handle> res;
+    for (auto c = first; c; c = trie.next_sibling(c)) {
+      res.push_back(c);
     }
-
-    return child;
+    std::sort(res.begin(), res.end(), [&trie](handle a, handle b) {
+      return trie.key(a) < trie.key(b);
+    });
+    return res;
   }
 
-  // finds a child or, if not present, its insertion place
-  // assumes there is at least one child
-  index_type guess_child(index_type n, key_type key) {
-    auto child = at(n).child;
-    assert(child != nullidx);
+  const Trie &_before;
+  const Trie &_after;
+  double _noise;
+  std::vector<key_type> _path;
+  std::vector<delta> _out;
+};
+} // namespace detail
+
+// Merge-walks two snapshots and returns every path that appeared, vanished or
+// changed. A path counts as changed when its total, calls or average moved by
+// more than `noise` relative to the larger of the two values (0.05 = 5%).
+template <typename T, typename Timer,
+          typename Key = typename key_traits<T>::owned_type>
+std::vector<path_delta<Key>> diff(const monitor<T, Timer> &before,
+                                  const monitor<T, Timer> &after,
+                                  double noise = 0) {
+  using storage_type = typename monitor<T, Timer>::storage_type;
+  return detail::differ<storage_type, Key>(before.storage(), after.storage(),
+                                           noise)
+      .run();
+}
 
-    while (at(child).key != key && at(child).sibling != nullidx) {
-      child = at(child).sibling;
-    }
+// a scope path known at compile time, e.g. static_path<int, 1, 2>
+template <typename K, K... Keys> struct static_path {
+  static_assert(sizeof...(Keys) > 0, "empty path");
 
-    return child;
-  }
+  using key_type = K;
+  static constexpr K keys[] = {Keys...};
 
-  index_type cursor = nullidx;
-  index_type root = nullidx;
-  unsigned trie_depth = 0;
-  heap_pool<node> pool;
+  static constexpr const K *begin() { return keys; }
+  static constexpr const K *end() { return keys + sizeof...(Keys); }
 };
 
-enum class report_type : int { averages, calls, percentages, totals, full };
+namespace detail {
+template <typename P, typename... Paths> struct path_index;
 
-template <typename T> class monitor {
-public:
-  class metric {
-  public:
-    metric() {}
+template <typename P, typename... Paths>
+struct path_index<P, P, Paths...> : std::integral_constant<std::size_t, 0> {};
 
-    ~metric() { stop(); }
+template <typename P, typename Q, typename... Paths>
+struct path_index<P, Q, Paths...>
+    : std::integral_constant<std::size_t,
+                             1 + path_index<P, Paths...>::value> {};
 
-    void stop() {
-      if (_mon) {
-        _mon->stop();
-      }
-      _mon = nullptr;
-    }
+template <typename P> struct path_index<P> {
+  static_assert(sizeof(P) == 0, "path is not declared in static_monitor");
+};
+} // namespace detail
+
+// Monitor for a scope hierarchy fixed at compile time. Each declared path owns
+// a slot in a flat array, so start/stop is a direct indexed timer update with
+// no trie lookup and no allocation. Paths are recorded as declared, the
+// caller is responsible for nesting scopes the way the paths describe.
+template <typename K, typename Timer, typename... Paths> class static_monitor {
+public:
+  using timer_type = Timer;
+  using report_t = typename monitor<K, Timer>::report_t;
 
+  class metric {
+  public:
     metric(const metric &) = delete;
     metric &operator=(const metric &) = delete;
 
-    metric(metric &&other) { *this = std::move(other); }
+    metric(metric &&other) : _timer(other._timer) { other._timer = nullptr; }
 
-    metric &operator=(metric &&other) {
-      stop();
-      _mon = other._mon;
+    ~metric() { stop(); }
 
-      other._mon = nullptr;
-      return *this;
+    void stop() {
+      if (_timer) {
+        _timer->stop();
+      }
+      _timer = nullptr;
     }
 
   private:
-    metric(T id, monitor &mon) : _mon(&mon) { _mon->start(id); }
+    explicit metric(timer_type &timer) : _timer(&timer) { _timer->start(); }
 
-    monitor *_mon = nullptr;
+    timer_type *_timer = nullptr;
 
-    friend class monitor;
+    friend class static_monitor;
   };
 
-  using report_t = tree<T, std::string>;
-
-  void start(T id) {
-    if (trie_.depth() > 0) {
-      return trie_.down(id).start();
-    }
-
-    if (sample_start_ > 0) {
-      if (--sample_start_) {
-        return;
-      }
-    }
-
-    if (sample_limit_ > 0) {
-      --sample_limit_;
-      return trie_.down(id).start();
-    }
-  }
-
-  void stop() {
-    if (sample_start_ == 0 && (trie_.depth() > 0 || sample_limit_ > 0)) {
-      trie_.up().stop();
-    }
-  }
-
-  void proceed(T id) {
-    stop();
-    start(id);
+  template <typename P> static constexpr std::size_t slot() {
+    return detail::path_index<P, Paths...>::value;
   }
 
-  metric scope(T id) { return metric(id, *this); }
+  template <typename P> void start() { get<P>().start(); }
 
-  metric operator()(T id) { return scope(id); }
+  template <typename P> void stop() { get<P>().stop(); }
 
-  report_t report(report_type type = report_type::averages) {
-    report_t res;
-    if (type != report_type::percentages && type != report_type::full) {
-      trie_.foreach_path(
-          [&res, type](const std::vector<T> path, aggregate_timer &val) {
-            switch (type) {
-            case report_type::averages:
-              res[path] = str(val.avg());
-              break;
-            case report_type::calls:
-              res[path] = str(val.calls());
-              break;
-            case report_type::totals:
-              res[path] = str(val.elapsed());
-              break;
-            default:
-              res[path] = "";
-              break;
-            }
-          });
-    } else {
-      uint64_t total_time = 0;
-      trie_.foreach_path(
-          [&total_time](const std::vector<T> path, aggregate_timer &val) {
-            if (path.size() == 1) {
-              total_time += val.elapsed();
-            }
-          });
+  template <typename P> metric scope() { return metric(get<P>()); }
 
-      trie_.foreach_path([&res, total_time, type](const std::vector<T> path,
-                                                  aggregate_timer &val) {
-        auto percentage = val.elapsed() / (double)total_time * 100;
-        if (type == report_type::percentages) {
-          res[path] = str(percentage) + "%";
-        } else {
-          std::stringstream ss;
-          ss << percentage << "% [" << val.elapsed() << "/ " << val.calls()
-             << " = " << val.avg() << " us]";
-          res[path] = ss.str();
-        }
-      });
-    }
+  template <typename P> timer_type &get() { return _slots[slot<P>()]; }
 
-    return res;
+  template <typename P> const timer_type &get() const {
+    return _slots[slot<P>()];
   }
 
-  template <typename F> void foreach (F &&f) {
-    // TODO perfect forwarding for f
-    trie_.foreach (
-        [&f](T key, timer &val) { f(key, val.elapsed(), val.calls()); });
+  // builds a regular monitor holding every declared path
+  monitor<K, Timer> to_monitor() const {
+    monitor<K, Timer> result;
+    std::size_t i = 0;
+    (result.add(Paths{}, _slots[i++]), ...);
+    return result;
   }
 
-  template <typename F> void foreach_path(F &&f) {
-    trie_.foreach_path([&f](const char *key, timer &val) {
-      f(key, val.elapsed(), val.calls());
-    });
+  report_t report(report_type type = report_type::averages) const {
+    return to_monitor().report(type);
   }
 
-  std::string report_json(report_type type = report_type::averages) {
-    return to_json(report(type));
+  std::string report_json(report_type type = report_type::averages) const {
+    return to_monitor().report_json(type);
   }
 
-  void stop_sampling_after(unsigned samples_num) {
-    sample_limit_ = samples_num;
-  }
+private:
+  timer_type _slots[sizeof...(Paths)] = {};
+};
 
-  void start_sampling_after(unsigned samples_num) {
-    sample_start_ = samples_num + 1;
-  }
+// placeholder returned for scopes compiled out by MEASURE_LEVEL
+struct null_metric {
+  void stop() {}
+};
 
-  monitor clone() const {
-    monitor result;
-    result.trie_ = std::move(trie_.clone());
-    return result;
+// returns a live metric if `Level` is within `MaxLevel`, an empty object
+// otherwise; use MEASURE_SCOPE_LEVEL rather than calling this directly
+template <int Level, int MaxLevel, typename Monitor, typename Id>
+auto scope(Monitor &mon, Id &&id) {
+  if constexpr (Level > 0 && Level <= MaxLevel) {
+    return mon.scope(std::forward<Id>(id));
+  } else {
+    (void)mon;
+    (void)id;
+    return null_metric{};
   }
+}
 
-  monitor combine(const monitor &other) const {
-    monitor result;
-    result.trie_ = std::move(trie_.combine(other.trie_));
-    return result;
-  }
+} // namespace measure
 
-private:
-  using timer = aggregate_timer;
-  trie<T, aggregate_timer> trie_;
-  unsigned sample_limit_ = 0xffffffff;
-  unsigned sample_start_ = 1;
+// Compile-time instrumentation levels: scopes of a level above MEASURE_LEVEL
+// compile to nothing, MEASURE_LEVEL 0 removes all of them. Define it before
+// including this header, consistently across translation units.
+#ifndef MEASURE_LEVEL
+#define MEASURE_LEVEL 1
+#endif
 
-  template <typename Type> static std::string str(Type &&t) {
-    std::stringstream ss;
-    ss << t;
-    return ss.str();
-  }
-};
+#define MEASURE_CONCAT_IMPL(a, b) a##b
+#define MEASURE_CONCAT(a, b) MEASURE_CONCAT_IMPL(a, b)
 
-} // namespace measure
+#define MEASURE_SCOPE_LEVEL(level, mon, id)                                    \
+  [[maybe_unused]] auto MEASURE_CONCAT(measure_scope_, __LINE__) =             \
+      ::measure::scope<(level), MEASURE_LEVEL>(mon, id)
+
+#define MEASURE_SCOPE(mon, id) MEASURE_SCOPE_LEVEL(1, mon, id)
@@ -0,0 +1,267 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#pragma once
+
+#include "measure/measure.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <charconv>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+namespace measure {
+
+namespace detail {
+inline void append_label_value(std::string &out, std::string_view text) {
+  for (auto c : text) {
+    switch (c) {
+    case '\\':
+      out += "\\\\";
+      break;
+    case '"':
+      out += "\\\"";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    default:
+      out += c;
+    }
+  }
+}
+
+// a path segment: '/' separates segments, so it is percent-encoded inside a
+// key, and so is '%' to keep distinct keys distinct
+inline void append_segment(std::string &out, std::string_view text) {
+  std::size_t begin = 0;
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '/' || text[i] == '%') {
+      append_label_value(out, text.substr(begin, i - begin));
+      out += text[i] == '/' ? "%2F" : "%25";
+      begin = i + 1;
+    }
+  }
+  append_label_value(out, text.substr(begin));
+}
+
+template <typename Int> void append_number(std::string &out, Int value) {
+  char buf[24];
+  const auto res = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, res.ptr);
+}
+
+template <typename K> void append_key(std::string &out, const K &key) {
+  if constexpr (std::is_integral<K>::value) {
+    append_number(out, key);
+  } else if constexpr (std::is_enum<K>::value) {
+    append_number(out, static_cast<std::underlying_type_t<K>>(key));
+  } else if constexpr (std::is_convertible<const K &, std::string_view>::value) {
+    append_segment(out, std::string_view(key));
+  } else {
+    std::ostringstream ss;
+    ss << key;
+    append_segment(out, ss.str());
+  }
+}
+
+template <typename View, typename Get>
+void append_family(std::string &out, View &view, std::string_view name,
+                   std::string_view unit, Get &&get) {
+  out += "# TYPE ";
+  out += name;
+  out += " counter\n";
+  if (!unit.empty()) {
+    out += "# UNIT ";
+    out += name;
+    out += ' ';
+    out += unit;
+    out += '\n';
+  }
+
+  for (auto e : view) {
+    out += name;
+    out += "_total{path=\"";
+    for (std::size_t i = 0; i < e.path.size(); ++i) {
+      if (i) {
+        out += '/';
+      }
+      append_key(out, e.path[i]);
+    }
+    out += "\"} ";
+    append_number(out, get(e.value));
+    out += '\n';
+  }
+}
+} // namespace detail
+
+// Appends the monitor counters to `out` in the OpenMetrics text format: one
+// counter family for the total time (microseconds) and one for the calls,
+// every trie node a sample labelled with its '/'-joined path, e.g.
+//   measure_time_microseconds_total{path="request/db"} 1520
+// A '/' or '%' inside a key is written as %2F or %25.
+// `out` is only appended to, so a cleared buffer can be reused between calls
+// without reallocating. No scope may be open.
+template <typename T, typename Timer>
+void write_openmetrics(std::string &out, const monitor<T, Timer> &mon,
+                       std::string_view prefix = "measure") {
+  auto view = mon.view();
+  const std::string_view time_suffix = "_time_microseconds";
+  const std::string_view calls_suffix = "_calls";
+
+  std::string name(prefix);
+  name += time_suffix;
+  detail::append_family(out, view, name, "microseconds",
+                        [](const Timer &t) { return t.elapsed(); });
+
+  name.resize(prefix.size());
+  name += calls_suffix;
+  detail::append_family(out, view, name, "",
+                        [](const Timer &t) { return t.calls(); });
+
+  out += "# EOF\n";
+}
+
+// Minimal HTTP endpoint for scrapers, listening on 127.0.0.1:<port> (0 picks
+// a free port, see port()). The background thread answers every request with
+// the text last passed to publish(); it never touches a monitor, so the
+// recording thread decides when a consistent snapshot is taken:
+//   openmetrics_server server(9464);
+//   ... between requests: server.publish(mon);
+class openmetrics_server {
+public:
+  explicit openmetrics_server(uint16_t port = 0) {
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_fd == -1) {
+      throw std::system_error(errno, std::generic_category(), "socket");
+    }
+
+    const int on = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    socklen_t len = sizeof(addr);
+    if (bind(_fd, reinterpret_cast<sockaddr *>(&addr), len) == -1 ||
+        listen(_fd, 16) == -1 ||
+        getsockname(_fd, reinterpret_cast<sockaddr *>(&addr), &len) == -1) {
+      const int err = errno;
+      ::close(_fd);
+      throw std::system_error(err, std::generic_category(), "bind");
+    }
+
+    _port = ntohs(addr.sin_port);
+    _body = "# EOF\n";
+    _thread = std::thread([this] { serve(); });
+  }
+
+  ~openmetrics_server() {
+    _stop = true;
+    _thread.join();
+    ::close(_fd);
+  }
+
+  openmetrics_server(const openmetrics_server &) = delete;
+  openmetrics_server &operator=(const openmetrics_server &) = delete;
+
+  uint16_t port() const { return _port; }
+
+  // renders the monitor into a scratch buffer and swaps it in; the buffers
+  // are reused, so steady-state publishing does not allocate
+  template <typename T, typename Timer>
+  void publish(const monitor<T, Timer> &mon, std::string_view prefix = "measure") {
+    _scratch.clear();
+    write_openmetrics(_scratch, mon, prefix);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _body.swap(_scratch);
+  }
+
+private:
+  void serve() {
+    std::string response;
+    while (!_stop) {
+      pollfd p{_fd, POLLIN, 0};
+      if (poll(&p, 1, 100) <= 0) {
+        continue;
+      }
+
+      const int client = accept4(_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client == -1) {
+        continue;
+      }
+
+      // the request itself is irrelevant, every path gets the metrics
+      char request[1024];
+      pollfd c{client, POLLIN, 0};
+      if (poll(&c, 1, 1000) > 0 && recv(client, request, sizeof(request), 0) > 0) {
+        respond(response);
+        send_all(client, response);
+      }
+      ::close(client);
+    }
+  }
+
+  void respond(std::string &response) {
+    response = "HTTP/1.0 200 OK\r\nContent-Type: application/openmetrics-text;"
+               " version=1.0.0; charset=utf-8\r\nContent-Length: ";
+    std::lock_guard<std::mutex> lock(_mutex);
+    detail::append_number(response, _body.size());
+    response += "\r\nConnection: close\r\n\r\n";
+    response += _body;
+  }
+
+  static void send_all(int fd, std::string_view data) {
+    while (!data.empty()) {
+      const auto n = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+      if (n <= 0) {
+        return;
+      }
+      data.remove_prefix(static_cast<std::size_t>(n));
+    }
+  }
+
+  int _fd = -1;
+  uint16_t _port = 0;
+  std::atomic<bool> _stop{false};
+  std::mutex _mutex;
+  std::string _body;
+  std::string _scratch;
+  std::thread _thread;
+};
+
+} // namespace measure
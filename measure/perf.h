@@ -0,0 +1,280 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#pragma once
+
+#include "measure/measure.h"
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace measure {
+
+// Per-thread group of hardware counters. The group is opened lazily on the
+// first read and closed when the thread exits. Counters are read in user space
+// with rdpmc when the kernel allows it, and with a single group read()
+// otherwise. When perf_event_open is not permitted (containers, paranoid
+// kernels, no PMU) the group reports zeroes and available() returns false.
+class perf_group {
+public:
+  enum counter : int { cycles, instructions, cache_misses, branch_misses };
+  static constexpr int size = 4;
+
+  using count_t = unsigned long long;
+  using sample = count_t[size];
+
+  perf_group() { open(); }
+
+  ~perf_group() { close(); }
+
+  perf_group(const perf_group &) = delete;
+  perf_group &operator=(const perf_group &) = delete;
+
+  bool available() const { return _fds[0] != -1; }
+
+  void read(sample &out) {
+    if (_rdpmc) {
+      for (int i = 0; i < size; ++i) {
+        out[i] = read_mmap(_pages[i]);
+      }
+    } else if (available()) {
+      read_group(out);
+    } else {
+      for (int i = 0; i < size; ++i) {
+        out[i] = 0;
+      }
+    }
+  }
+
+  static perf_group &this_thread() {
+    static thread_local perf_group group;
+    return group;
+  }
+
+private:
+  using page_t = perf_event_mmap_page;
+
+  void open() {
+    static const unsigned long long configs[size] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+    for (int i = 0; i < size; ++i) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = configs[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      _fds[i] = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, i ? _fds[0] : -1, 0));
+      if (_fds[i] == -1) {
+        close();
+        return;
+      }
+    }
+
+    map_pages();
+  }
+
+  void map_pages() {
+#if defined(__x86_64__) || defined(__i386__)
+    for (int i = 0; i < size; ++i) {
+      auto p = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                    _fds[i], 0);
+      if (p == MAP_FAILED) {
+        unmap_pages();
+        return;
+      }
+
+      _pages[i] = static_cast<page_t *>(p);
+      if (!_pages[i]->cap_user_rdpmc) {
+        unmap_pages();
+        return;
+      }
+    }
+
+    _rdpmc = true;
+#endif
+  }
+
+  void unmap_pages() {
+    for (auto &p : _pages) {
+      if (p) {
+        munmap(p, sysconf(_SC_PAGESIZE));
+      }
+      p = nullptr;
+    }
+    _rdpmc = false;
+  }
+
+  void close() {
+    unmap_pages();
+    for (auto &fd : _fds) {
+      if (fd != -1) {
+        ::close(fd);
+      }
+      fd = -1;
+    }
+  }
+
+  void read_group(sample &out) {
+    // PERF_FORMAT_GROUP layout: { nr, values[nr] }
+    count_t buf[size + 1] = {};
+    if (::read(_fds[0], buf, sizeof(buf)) != sizeof(buf)) {
+      for (int i = 0; i < size; ++i) {
+        out[i] = 0;
+      }
+      return;
+    }
+
+    for (int i = 0; i < size; ++i) {
+      out[i] = buf[i + 1];
+    }
+  }
+
+  static count_t read_mmap(const volatile page_t *pc) {
+#if defined(__x86_64__) || defined(__i386__)
+    // see the seqlock protocol described in linux/perf_event.h
+    uint32_t seq;
+    count_t count;
+    do {
+      seq = pc->lock;
+      __asm__ volatile("" ::: "memory");
+
+      const auto idx = pc->index;
+      count = pc->offset;
+      if (idx) {
+        uint32_t lo, hi;
+        __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx - 1));
+        int64_t pmc = (static_cast<count_t>(hi) << 32) | lo;
+        const auto shift = 64 - pc->pmc_width;
+        pmc <<= shift;
+        pmc >>= shift;
+        count += pmc;
+      }
+
+      __asm__ volatile("" ::: "memory");
+    } while (pc->lock != seq);
+
+    return count;
+#else
+    (void)pc;
+    return 0;
+#endif
+  }
+
+  int _fds[size] = {-1, -1, -1, -1};
+  page_t *_pages[size] = {};
+  bool _rdpmc = false;
+};
+
+// aggregate_timer extended with hardware counters: cycles, instructions,
+// cache misses and branch misses are accumulated per node, so a report can
+// tell compute-bound scopes (high IPC) from memory-bound ones (low IPC, many
+// cache misses per call)
+class perf_timer {
+public:
+  using usec_t = aggregate_timer::usec_t;
+  using num_t = aggregate_timer::num_t;
+  using count_t = perf_group::count_t;
+
+  void start() {
+    perf_group::sample now;
+    perf_group::this_thread().read(now);
+    for (int i = 0; i < perf_group::size; ++i) {
+      _counters[i] = now[i] - _counters[i];
+    }
+    _elapsed = aggregate_timer::now() - _elapsed;
+  }
+
+  void stop() {
+    _elapsed = aggregate_timer::now() - _elapsed;
+    perf_group::sample now;
+    perf_group::this_thread().read(now);
+    for (int i = 0; i < perf_group::size; ++i) {
+      _counters[i] = now[i] - _counters[i];
+    }
+    ++_calls;
+  }
+
+  usec_t elapsed() const { return _elapsed; }
+
+  num_t calls() const { return _calls; }
+
+  double avg() const { return _calls ? (double)_elapsed / _calls : 0; }
+
+  count_t cycles() const { return _counters[perf_group::cycles]; }
+
+  count_t instructions() const { return _counters[perf_group::instructions]; }
+
+  count_t cache_misses() const { return _counters[perf_group::cache_misses]; }
+
+  count_t branch_misses() const {
+    return _counters[perf_group::branch_misses];
+  }
+
+  double ipc() const {
+    return cycles() ? (double)instructions() / cycles() : 0;
+  }
+
+  double cache_misses_per_call() const {
+    return _calls ? (double)cache_misses() / _calls : 0;
+  }
+
+  double branch_misses_per_call() const {
+    return _calls ? (double)branch_misses() / _calls : 0;
+  }
+
+  static bool available() { return perf_group::this_thread().available(); }
+
+  void describe(std::ostream &stream) const {
+    stream << "ipc=" << ipc() << " cache-misses/call=" << cache_misses_per_call()
+           << " branch-misses/call=" << branch_misses_per_call();
+  }
+
+  perf_timer &operator+=(const perf_timer &other) {
+    _elapsed += other._elapsed;
+    _calls += other._calls;
+    for (int i = 0; i < perf_group::size; ++i) {
+      _counters[i] += other._counters[i];
+    }
+    return *this;
+  }
+
+private:
+  usec_t _elapsed = 0;
+  num_t _calls = 0;
+  count_t _counters[perf_group::size] = {};
+};
+
+} // namespace measure
@@ -0,0 +1,273 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#pragma once
+
+#include "measure/measure.h"
+
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace measure {
+
+// Shared memory layout, version 1. All fields use the host byte order.
+//
+//   offset 0   shm_header (64 bytes)
+//   offset 64  shm_record[capacity] (64 bytes each)
+//
+// Records are stored in preorder: a parent always precedes its children and
+// `parent` holds the parent's record index, or shm_no_parent for top-level
+// scopes. Integral and enum keys are stored in `key`, string keys in
+// `name` (NUL-terminated, truncated to 31 characters).
+//
+// `generation` is a seqlock: it is odd while the writer is updating the
+// records. A reader copies the records and retries if the generation was odd
+// or changed in the meantime.
+constexpr uint64_t shm_magic = 0x45525553'4145'4d00; // "\0MEASURE"
+constexpr uint32_t shm_version = 1;
+constexpr uint32_t shm_no_parent = 0xffffffff;
+constexpr uint32_t shm_truncated = 1; // not all nodes fit into the mapping
+
+struct shm_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t capacity;
+  uint32_t count;
+  std::atomic<uint64_t> generation;
+  uint64_t publish_time; // usec, aggregate_timer::now()
+  uint32_t flags;
+  uint32_t reserved[5];
+};
+
+struct shm_record {
+  uint32_t parent;
+  uint32_t depth;
+  int64_t key;
+  uint64_t elapsed; // usec
+  uint64_t calls;
+  char name[32];
+};
+
+static_assert(sizeof(shm_header) == 64, "shm_header layout");
+static_assert(sizeof(shm_record) == 64, "shm_record layout");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "seqlock needs a lock-free counter");
+
+namespace detail {
+template <typename K> void encode_key(shm_record &rec, const K &key) {
+  if constexpr (std::is_integral<K>::value || std::is_enum<K>::value) {
+    rec.key = static_cast<int64_t>(key);
+  } else {
+    const std::string_view name(key);
+    const auto len = std::min(name.size(), sizeof(rec.name) - 1);
+    std::memcpy(rec.name, name.data(), len);
+  }
+}
+
+inline size_t shm_size(uint32_t capacity) {
+  return sizeof(shm_header) + capacity * sizeof(shm_record);
+}
+} // namespace detail
+
+// Publishes monitor counters into a named POSIX shared memory object
+// (/dev/shm/<name>) so that an external agent can read them at any rate.
+// publish() copies raw counters only, no formatting, and is meant to be
+// called by the recording thread when no scopes are open, e.g. between
+// requests.
+class shm_writer {
+public:
+  shm_writer(std::string name, uint32_t capacity)
+      : _name(std::move(name)), _size(detail::shm_size(capacity)) {
+    const int fd = shm_open(_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd == -1) {
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+
+    if (ftruncate(fd, _size) == -1) {
+      const int err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), "ftruncate");
+    }
+
+    auto p = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+
+    _header = new (p) shm_header{};
+    _header->magic = shm_magic;
+    _header->version = shm_version;
+    _header->record_size = sizeof(shm_record);
+    _header->capacity = capacity;
+    _records = reinterpret_cast<shm_record *>(_header + 1);
+  }
+
+  shm_writer(const shm_writer &) = delete;
+  shm_writer &operator=(const shm_writer &) = delete;
+
+  ~shm_writer() {
+    munmap(_header, _size);
+    shm_unlink(_name.c_str());
+  }
+
+  template <typename Monitor> void publish(const Monitor &mon) {
+    assert(mon.depth() == 0);
+
+    const auto gen = _header->generation.load(std::memory_order_relaxed);
+    _header->generation.store(gen + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint32_t count = 0;
+    uint32_t flags = 0;
+    uint32_t parents[max_depth];
+    mon.foreach_preorder([&](unsigned depth, const auto &key, const auto &val) {
+      if (count == _header->capacity || depth >= max_depth) {
+        flags |= shm_truncated;
+        return;
+      }
+
+      parents[depth] = count;
+      auto &rec = _records[count++];
+      rec = shm_record{};
+      rec.parent = depth ? parents[depth - 1] : shm_no_parent;
+      rec.depth = depth;
+      rec.elapsed = val.elapsed();
+      rec.calls = val.calls();
+      detail::encode_key(rec, key);
+    });
+
+    _header->count = count;
+    _header->flags = flags;
+    _header->publish_time = aggregate_timer::now();
+
+    _header->generation.store(gen + 2, std::memory_order_release);
+  }
+
+  const std::string &name() const { return _name; }
+
+private:
+  static constexpr unsigned max_depth = 256;
+
+  std::string _name;
+  size_t _size;
+  shm_header *_header = nullptr;
+  shm_record *_records = nullptr;
+};
+
+// Reads consistent snapshots of the records published by a shm_writer,
+// possibly from another process
+class shm_reader {
+public:
+  explicit shm_reader(const std::string &name) {
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+      throw std::system_error(errno, std::generic_category(), "shm_open");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(shm_header)) {
+      close(fd);
+      throw std::runtime_error("measure: bad shared memory object " + name);
+    }
+
+    _size = st.st_size;
+    auto p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+
+    _header = static_cast<const shm_header *>(p);
+    if (_header->magic != shm_magic || _header->version != shm_version ||
+        _header->record_size != sizeof(shm_record) ||
+        detail::shm_size(_header->capacity) > _size) {
+      munmap(p, _size);
+      throw std::runtime_error("measure: unsupported layout in " + name);
+    }
+  }
+
+  shm_reader(const shm_reader &) = delete;
+  shm_reader &operator=(const shm_reader &) = delete;
+
+  ~shm_reader() { munmap(const_cast<shm_header *>(_header), _size); }
+
+  // Copies the latest published records into `out` and returns their
+  // generation. Throws std::runtime_error when no consistent copy could be
+  // taken within `timeout_usec`, i.e. the writer died or stalled in the middle
+  // of a publish.
+  uint64_t read(std::vector<shm_record> &out, uint32_t *flags = nullptr,
+                uint64_t timeout_usec = 100000) const {
+    auto records = reinterpret_cast<const shm_record *>(_header + 1);
+    const auto deadline = aggregate_timer::now() + timeout_usec;
+    for (unsigned attempt = 0;; ++attempt) {
+      const auto before = _header->generation.load(std::memory_order_acquire);
+      if (!(before & 1)) {
+        const auto count = std::min(_header->count, _header->capacity);
+        out.assign(records, records + count);
+        if (flags) {
+          *flags = _header->flags;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (_header->generation.load(std::memory_order_relaxed) == before) {
+          return before;
+        }
+      }
+
+      if (aggregate_timer::now() >= deadline) {
+        throw std::runtime_error("measure: shared memory writer stalled");
+      }
+      backoff(attempt);
+    }
+  }
+
+private:
+  // a publish takes microseconds: yield first, then sleep up to 1ms
+  static void backoff(unsigned attempt) {
+    if (attempt < 8) {
+      sched_yield();
+    } else {
+      usleep(std::min(1000u, 10u << std::min(attempt - 8, 7u)));
+    }
+  }
+
+  const shm_header *_header = nullptr;
+  size_t _size = 0;
+};
+
+} // namespace measure
@@ -0,0 +1,182 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#pragma once
+
+#include "measure/measure.h"
+
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace measure {
+
+// Binary monitor snapshot, version 1. Integers are little-endian.
+//
+//   header:  u32 magic "MSNP", u32 version, u32 key kind (0 integer, 1 string)
+//   records: u32 depth, key, u64 elapsed usec, u64 calls
+//   end:     u32 0xffffffff
+//
+// Records are in preorder, so a record at depth d belongs under the last
+// record seen at depth d - 1. Integer keys are stored as i64, string keys as a
+// u32 length followed by the bytes.
+constexpr uint32_t snapshot_magic = 0x504e534d; // "MSNP"
+constexpr uint32_t snapshot_version = 1;
+constexpr uint32_t snapshot_end = 0xffffffff;
+
+enum class snapshot_key : uint32_t { integer = 0, string = 1 };
+
+namespace detail {
+template <typename K> constexpr bool is_integer_key() {
+  return std::is_integral<K>::value || std::is_enum<K>::value;
+}
+
+template <typename U> void write_le(std::ostream &stream, U val) {
+  char buf[sizeof(U)];
+  for (std::size_t i = 0; i < sizeof(U); ++i) {
+    buf[i] = static_cast<char>((uint64_t)val >> (8 * i));
+  }
+  stream.write(buf, sizeof(buf));
+}
+
+template <typename U> U read_le(std::istream &stream) {
+  unsigned char buf[sizeof(U)];
+  if (!stream.read(reinterpret_cast<char *>(buf), sizeof(buf))) {
+    throw std::runtime_error("measure: truncated snapshot");
+  }
+
+  uint64_t val = 0;
+  for (std::size_t i = 0; i < sizeof(U); ++i) {
+    val |= (uint64_t)buf[i] << (8 * i);
+  }
+  return static_cast<U>(val);
+}
+} // namespace detail
+
+template <typename T, typename Timer>
+void write_snapshot(std::ostream &stream, const monitor<T, Timer> &mon) {
+  constexpr bool integer = detail::is_integer_key<T>();
+
+  detail::write_le<uint32_t>(stream, snapshot_magic);
+  detail::write_le<uint32_t>(stream, snapshot_version);
+  detail::write_le<uint32_t>(stream, uint32_t(integer ? snapshot_key::integer
+                                                      : snapshot_key::string));
+
+  mon.foreach_preorder([&stream](unsigned depth, const T &key, const Timer &val) {
+    detail::write_le<uint32_t>(stream, depth);
+    if constexpr (integer) {
+      detail::write_le<int64_t>(stream, static_cast<int64_t>(key));
+    } else {
+      const std::string_view name(key);
+      detail::write_le<uint32_t>(stream, static_cast<uint32_t>(name.size()));
+      stream.write(name.data(), name.size());
+    }
+    detail::write_le<uint64_t>(stream, val.elapsed());
+    detail::write_le<uint64_t>(stream, val.calls());
+  });
+
+  detail::write_le<uint32_t>(stream, snapshot_end);
+}
+
+// Streams one snapshot into `mon`, adding to what it already holds. Only the
+// current path is buffered, so merging any number of snapshots one after
+// another needs no more memory than the aggregate itself. Integer keys can be
+// read into string-keyed monitors (as decimal text), not the other way round.
+template <typename T, typename Timer>
+void read_snapshot(std::istream &stream, monitor<T, Timer> &mon) {
+  static_assert(std::is_constructible<Timer, uint64_t, uint64_t>::value,
+                "timer must be constructible from (elapsed, calls)");
+  static_assert(detail::is_integer_key<T>() ||
+                    std::is_constructible<T, std::string>::value,
+                "keys must be integers or constructible from a string");
+
+  if (detail::read_le<uint32_t>(stream) != snapshot_magic) {
+    throw std::runtime_error("measure: not a snapshot");
+  }
+  if (detail::read_le<uint32_t>(stream) != snapshot_version) {
+    throw std::runtime_error("measure: unsupported snapshot version");
+  }
+
+  const auto kind = static_cast<snapshot_key>(detail::read_le<uint32_t>(stream));
+  if (kind != snapshot_key::integer && kind != snapshot_key::string) {
+    throw std::runtime_error("measure: unknown snapshot key kind");
+  }
+  if (kind == snapshot_key::string && detail::is_integer_key<T>()) {
+    throw std::runtime_error("measure: string keys in an integer monitor");
+  }
+
+  // string keys are kept as owned strings and only converted to T while the
+  // monitor adds them, so non-owning keys such as std::string_view never
+  // outlive the name they refer to
+  using path_key = std::conditional_t<detail::is_integer_key<T>(), T, std::string>;
+  std::vector<path_key> path;
+  std::vector<T> keys;
+  std::string name;
+  for (;;) {
+    const auto depth = detail::read_le<uint32_t>(stream);
+    if (depth == snapshot_end) {
+      break;
+    }
+    if (depth > path.size()) {
+      throw std::runtime_error("measure: malformed snapshot");
+    }
+
+    path.resize(depth);
+    if (kind == snapshot_key::integer) {
+      const auto key = detail::read_le<int64_t>(stream);
+      if constexpr (detail::is_integer_key<T>()) {
+        path.push_back(static_cast<T>(key));
+      } else {
+        path.push_back(std::to_string(key));
+      }
+    } else {
+      name.resize(detail::read_le<uint32_t>(stream));
+      if (!stream.read(&name[0], name.size())) {
+        throw std::runtime_error("measure: truncated snapshot");
+      }
+      if constexpr (!detail::is_integer_key<T>()) {
+        path.push_back(name);
+      }
+    }
+
+    const auto elapsed = detail::read_le<uint64_t>(stream);
+    const auto calls = detail::read_le<uint64_t>(stream);
+    if constexpr (std::is_same<path_key, T>::value) {
+      mon.add(path, Timer(elapsed, calls));
+    } else {
+      keys.clear();
+      for (auto &k : path) {
+        keys.push_back(T(k));
+      }
+      mon.add(keys, Timer(elapsed, calls));
+    }
+  }
+}
+
+} // namespace measure
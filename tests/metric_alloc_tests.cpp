@@ -0,0 +1,80 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#define MEASURE_ALLOC_HOOKS
+#include "measure/alloc.h"
+#include <gtest/gtest.h>
+
+namespace {
+// keeps the compiler from eliding new/delete pairs
+void *volatile sink;
+
+void allocate(std::size_t bytes) {
+  auto p = new char[bytes];
+  sink = p;
+  delete[] p;
+}
+} // namespace
+
+TEST(metric_alloc_test, charges_allocations_to_innermost_scope) {
+  measure::monitor<int, measure::alloc_timer> mon;
+  mon.reserve(16);
+
+  for (int i = 0; i < 2; ++i) {
+    mon.start(1);
+    allocate(10);
+    mon.start(2);
+    allocate(100);
+    allocate(200);
+    mon.stop();
+    allocate(20);
+    mon.stop();
+  }
+  allocate(1000);
+
+  auto &trie = mon.storage();
+  auto outer = trie.first_root();
+  auto inner = trie.first_child(outer);
+  EXPECT_EQ(4u, trie.value(outer).allocs());
+  EXPECT_EQ(60u, trie.value(outer).bytes());
+  EXPECT_EQ(4u, trie.value(inner).allocs());
+  EXPECT_EQ(600u, trie.value(inner).bytes());
+  EXPECT_EQ(300, trie.value(inner).bytes_per_call());
+
+  std::stringstream ss;
+  measure::describe(ss, trie.value(inner));
+  EXPECT_EQ("allocs/call=2 bytes/call=300", ss.str());
+}
+
+TEST(metric_alloc_test, ignores_allocations_outside_scopes) {
+  measure::alloc_timer t;
+  allocate(10);
+  t.start();
+  t.stop();
+  EXPECT_EQ(0u, t.allocs());
+  EXPECT_EQ(nullptr, measure::detail::current_allocs);
+}
@@ -27,6 +27,8 @@ For more information, please refer to <http://unlicense.org/>
 
 #include "measure/measure.h"
 #include <gtest/gtest.h>
+#include <unistd.h>
+#include <thread>
 
 struct metric_monitors_test : ::testing::Test {
   using mon_t = measure::monitor<int>;
@@ -356,3 +358,711 @@ TEST_F(metric_monitors_test, continue_measuring_with_new_name) {
 
   EXPECT_EQ("{a:0,b:0}", report(mon));
 }
+
+TEST_F(metric_monitors_test, tracks_duration_statistics) {
+  measure::stats_timer stats;
+  stats.add(2);
+  stats.add(4);
+  stats.add(9);
+
+  EXPECT_EQ(3u, stats.calls());
+  EXPECT_EQ(15u, stats.elapsed());
+  EXPECT_EQ(2u, stats.min());
+  EXPECT_EQ(9u, stats.max());
+  EXPECT_DOUBLE_EQ(5, stats.avg());
+  EXPECT_DOUBLE_EQ(13, stats.variance());
+}
+
+TEST_F(metric_monitors_test, merges_duration_statistics_exactly) {
+  measure::stats_timer all, lhs, rhs;
+  for (auto d : {1, 5, 7, 20, 3, 3}) {
+    all.add(d);
+    (d % 2 ? lhs : rhs).add(d);
+  }
+
+  lhs.merge(rhs);
+  EXPECT_EQ(all.calls(), lhs.calls());
+  EXPECT_EQ(all.min(), lhs.min());
+  EXPECT_EQ(all.max(), lhs.max());
+  EXPECT_DOUBLE_EQ(all.avg(), lhs.avg());
+  EXPECT_DOUBLE_EQ(all.variance(), lhs.variance());
+}
+
+TEST_F(metric_monitors_test, combines_statistics_monitors) {
+  measure::monitor<int, measure::stats_timer> lhs, rhs;
+  lhs.start(1);
+  lhs.stop();
+  rhs.start(1);
+  rhs.stop();
+
+  auto combine = lhs.combine(rhs);
+  EXPECT_EQ("{1:2}", exact_report(combine, measure::report_type::calls));
+  auto rep = combine.report(measure::report_type::details);
+  EXPECT_EQ(0u, rep[1].find("min="));
+  EXPECT_NE(std::string::npos, rep[1].find("stddev="));
+}
+
+TEST_F(metric_monitors_test, records_nothing_while_disabled) {
+  mon.disable();
+  mon.start(1);
+  mon.stop();
+
+  EXPECT_FALSE(mon.enabled());
+  EXPECT_EQ("{}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, keeps_scopes_balanced_when_toggled) {
+  mon.start(1);
+  mon.disable();
+  mon.start(2);
+  mon.enable();
+  mon.start(3);
+  mon.stop();
+  mon.stop();
+  mon.stop();
+
+  mon.start(4);
+  mon.stop();
+
+  EXPECT_EQ("{1:1,4:1}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, compiles_out_scopes_above_level) {
+  {
+    MEASURE_SCOPE(mon, 1);
+    MEASURE_SCOPE_LEVEL(2, mon, 2);
+  }
+
+  EXPECT_EQ("{1:1}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, records_static_paths) {
+  using root = measure::static_path<int, 1>;
+  using leaf = measure::static_path<int, 1, 2>;
+  using other = measure::static_path<int, 3>;
+  measure::static_monitor<int, measure::aggregate_timer, root, leaf, other>
+      mon;
+
+  static_assert(decltype(mon)::slot<leaf>() == 1, "declaration order");
+
+  {
+    auto outer = mon.scope<root>();
+    auto inner = mon.scope<leaf>();
+  }
+  mon.start<leaf>();
+  mon.stop<leaf>();
+
+  EXPECT_EQ(2u, mon.get<leaf>().calls());
+  EXPECT_EQ("{1:{#:1,2:2},3:0}",
+            exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, finds_hottest_paths) {
+  measure::monitor<int, measure::stats_timer> mon;
+  auto sample = [](std::initializer_list<int> durations) {
+    measure::stats_timer t;
+    for (auto d : durations) {
+      t.add(d);
+    }
+    return t;
+  };
+
+  mon.add(std::vector<int>{1}, sample({100}));
+  mon.add(std::vector<int>{1, 2}, sample({30, 30}));
+  mon.add(std::vector<int>{1, 3}, sample({50}));
+  mon.add(std::vector<int>{4}, sample({40, 40, 40}));
+
+  auto top = mon.top_k(2);
+  ASSERT_EQ(2u, top.size());
+  EXPECT_EQ(std::vector<int>{4}, top[0].path);
+  EXPECT_EQ(120, top[0].value);
+  EXPECT_EQ(std::vector<int>{1}, top[1].path);
+
+  top = mon.top_k(1, measure::top_metric::self);
+  ASSERT_EQ(1u, top.size());
+  EXPECT_EQ(std::vector<int>{4}, top[0].path);
+
+  top = mon.top_k(3, measure::top_metric::average, 45);
+  ASSERT_EQ(2u, top.size());
+  EXPECT_EQ(std::vector<int>{1}, top[0].path);
+  EXPECT_EQ((std::vector<int>{1, 3}), top[1].path);
+
+  top = mon.top_k(10, measure::top_metric::calls, 0, 2);
+  ASSERT_EQ(2u, top.size());
+  EXPECT_EQ(3u, top[0].timer.calls());
+  EXPECT_EQ((std::vector<int>{1, 2}), top[1].path);
+
+  // every path, k is only an upper bound
+  top = mon.top_k(std::numeric_limits<std::size_t>::max());
+  EXPECT_EQ(mon.size(), top.size());
+}
+
+TEST_F(metric_monitors_test, diffs_snapshots) {
+  measure::monitor<int, measure::stats_timer> before, after;
+  auto sample = [](std::initializer_list<int> durations) {
+    measure::stats_timer t;
+    for (auto d : durations) {
+      t.add(d);
+    }
+    return t;
+  };
+
+  before.add(std::vector<int>{1}, sample({100}));
+  before.add(std::vector<int>{1, 2}, sample({10}));
+  before.add(std::vector<int>{3}, sample({50}));
+  before.add(std::vector<int>{3, 4}, sample({5}));
+
+  after.add(std::vector<int>{1}, sample({102}));
+  after.add(std::vector<int>{1, 2}, sample({20}));
+  after.add(std::vector<int>{5}, sample({7}));
+
+  auto deltas = measure::diff(before, after, 0.05);
+  ASSERT_EQ(4u, deltas.size());
+
+  EXPECT_EQ((std::vector<int>{1, 2}), deltas[0].path);
+  EXPECT_EQ(measure::path_change::changed, deltas[0].change);
+  EXPECT_EQ(10, deltas[0].total_delta());
+  EXPECT_EQ(2, deltas[0].avg_ratio());
+
+  EXPECT_EQ(std::vector<int>{3}, deltas[1].path);
+  EXPECT_EQ(measure::path_change::removed, deltas[1].change);
+  EXPECT_EQ((std::vector<int>{3, 4}), deltas[2].path);
+  EXPECT_EQ(measure::path_change::removed, deltas[2].change);
+
+  EXPECT_EQ(std::vector<int>{5}, deltas[3].path);
+  EXPECT_EQ(measure::path_change::added, deltas[3].change);
+  EXPECT_EQ(7, deltas[3].after.total);
+
+  EXPECT_EQ(5u, measure::diff(before, after).size());
+}
+
+TEST_F(metric_monitors_test, interns_string_view_keys) {
+  measure::monitor<std::string_view> mon;
+  for (int i = 0; i < 3; ++i) {
+    std::string parsed = "request";
+    mon.start(parsed);
+    parsed = "db";
+    mon.start(parsed);
+    mon.stop();
+    mon.stop();
+  }
+
+  EXPECT_EQ("{request:{#:3,db:3}}",
+            exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, does_not_intern_keys_it_does_not_record) {
+  measure::monitor<std::string_view> mon;
+  mon.disable();
+  for (int i = 0; i < 1000; ++i) {
+    mon.start(std::to_string(i));
+    auto s = mon.scope(std::to_string(i));
+    mon.stop();
+  }
+  EXPECT_EQ(0u, mon.memory());
+
+  mon.enable();
+  mon.start_sampling_after(1000);
+  for (int i = 0; i < 999; ++i) {
+    mon.start(std::to_string(i));
+    mon.stop();
+  }
+  EXPECT_EQ(0u, mon.memory());
+}
+
+TEST_F(metric_monitors_test, starts_with_preinterned_keys) {
+  measure::monitor<std::string_view> mon;
+  const auto id = mon.intern("handler");
+  mon.start(id);
+  mon.stop();
+  mon.start(std::string_view("handler"));
+  mon.stop();
+
+  EXPECT_EQ(id, mon.intern(std::string("handler")));
+  EXPECT_EQ("{handler:2}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, combines_monitors_with_separate_arenas) {
+  measure::monitor<std::string_view> lhs, rhs;
+  lhs.start("a");
+  lhs.stop();
+  rhs.start("a");
+  rhs.start("b");
+  rhs.stop();
+  rhs.stop();
+
+  auto combine = lhs.combine(rhs);
+  EXPECT_EQ("{a:{#:2,b:1}}", exact_report(combine, measure::report_type::calls));
+
+  auto top = combine.top_k(1, measure::top_metric::calls);
+  ASSERT_EQ(1u, top.size());
+  EXPECT_EQ(std::vector<std::string>{"a"}, top[0].path);
+}
+
+TEST_F(metric_monitors_test, clones_own_their_interned_keys) {
+  auto source = std::make_unique<measure::monitor<std::string_view>>();
+  source->start("a");
+  source->stop();
+
+  auto clone = source->clone();
+  auto combine = source->combine(clone);
+  source.reset();
+
+  clone.start("b");
+  clone.stop();
+  EXPECT_EQ("{a:1,b:1}", exact_report(clone, measure::report_type::calls));
+  EXPECT_EQ("{a:2}", exact_report(combine, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, resets_counters_and_keeps_paths) {
+  mon.start(1);
+  mon.start(2);
+  mon.stop();
+  mon.stop();
+
+  mon.reset();
+  EXPECT_EQ("{1:{#:0,2:0}}", exact_report(mon, measure::report_type::calls));
+
+  mon.start(1);
+  mon.stop();
+  EXPECT_EQ("{1:{#:1,2:0}}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, scales_counters) {
+  mon.add(std::vector<int>{1}, measure::aggregate_timer(100, 4));
+  mon.add(std::vector<int>{1, 2}, measure::aggregate_timer(50, 2));
+
+  mon.scale(0.5);
+  EXPECT_EQ("{1:{#:2,2:1}}", exact_report(mon, measure::report_type::calls));
+  EXPECT_EQ("{1:{#:50,2:25}}", exact_report(mon, measure::report_type::totals));
+  EXPECT_EQ("{1:{#:100%,2:50%}}",
+            exact_report(mon, measure::report_type::percentages));
+}
+
+TEST_F(metric_monitors_test, evicts_cold_paths) {
+  for (int request = 0; request < 3; ++request) {
+    mon.start(1);
+    mon.start(100 + request);
+    mon.stop();
+    mon.stop();
+    mon.evict(1);
+  }
+
+  EXPECT_EQ(2u, mon.size());
+  EXPECT_EQ("{1:{#:3,102:1}}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, releases_interned_keys_of_evicted_paths) {
+  measure::monitor<std::string_view> mon;
+  const auto pinned = mon.intern("pinned");
+  std::size_t memory = 0;
+  for (int round = 0; round < 3; ++round) {
+    mon.start("hot");
+    mon.stop();
+    for (int i = 0; i < 5000; ++i) {
+      mon.start("request-" + std::to_string(round * 5000 + i));
+      mon.stop();
+    }
+    mon.evict(1);
+    mon.start("hot");
+    mon.stop();
+    mon.evict(1);
+
+    if (round == 0) {
+      memory = mon.memory();
+    }
+    EXPECT_EQ(memory, mon.memory());
+  }
+
+  mon.start(pinned);
+  mon.stop();
+  EXPECT_EQ(pinned, mon.intern("pinned"));
+  EXPECT_EQ("{hot:6,pinned:1}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, prewarms_paths) {
+  mon.prewarm({{1, 2}, {1, 3}});
+  EXPECT_EQ("{1:{#:0,2:0,3:0}}", exact_report(mon, measure::report_type::calls));
+
+  mon.mark_warm();
+  mon.start(1);
+  mon.start(3);
+  mon.stop();
+  mon.stop();
+  EXPECT_EQ(0u, mon.cold_allocations());
+
+  for (int i = 0; i < 100; ++i) {
+    mon.start(i + 10);
+    mon.stop();
+  }
+  EXPECT_LT(0u, mon.cold_allocations());
+}
+
+TEST_F(metric_monitors_test, records_reserved_paths_without_allocating) {
+  mon.reserve(2000);
+  mon.mark_warm();
+
+  for (int i = 0; i < 2000; ++i) {
+    mon.start(i);
+    mon.stop();
+  }
+  EXPECT_EQ(2000u, mon.size());
+  EXPECT_EQ(0u, mon.cold_allocations());
+}
+
+TEST_F(metric_monitors_test, views_typed_stats_in_dfs_order) {
+  mon.add(std::vector<int>{1}, measure::aggregate_timer(100, 4));
+  mon.add(std::vector<int>{1, 2}, measure::aggregate_timer(50, 2));
+  mon.add(std::vector<int>{1, 2, 3}, measure::aggregate_timer(20, 1));
+  mon.add(std::vector<int>{4}, measure::aggregate_timer(10, 1));
+
+  std::string order;
+  std::vector<int> last;
+  auto view = mon.view();
+  for (auto e : view) {
+    order += std::to_string(e.key()) + ":" + std::to_string(e.depth()) + " ";
+    last.assign(e.path.begin(), e.path.end());
+  }
+  EXPECT_EQ("4:0 1:0 2:1 3:2 ", order);
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), last);
+
+  unsigned long calls = 0;
+  view.foreach ([&calls](auto path, const measure::aggregate_timer &t) {
+    calls += path.size() * t.calls();
+  });
+  EXPECT_EQ(4u + 2 * 2 + 3 * 1 + 1, calls);
+}
+
+TEST_F(metric_monitors_test, walks_paths_of_any_key_type) {
+  mon.add(std::vector<int>{1, 2}, measure::aggregate_timer(50, 2));
+
+  std::vector<std::string> seen;
+  mon.foreach_path([&seen](auto path, unsigned long elapsed, unsigned long calls) {
+    std::string s;
+    for (auto k : path) {
+      s += std::to_string(k) + "/";
+    }
+    seen.push_back(s + std::to_string(elapsed) + "/" + std::to_string(calls));
+  });
+  EXPECT_EQ(std::vector<std::string>({"1/0/0", "1/2/50/2"}), seen);
+}
+
+TEST_F(metric_monitors_test, formats_report_on_several_threads) {
+  for (int i = 0; i < 10; ++i) {
+    mon.add(std::vector<int>{i}, measure::aggregate_timer(100 + i, 4));
+    mon.add(std::vector<int>{i, 1}, measure::aggregate_timer(50, 2));
+  }
+
+  for (auto type : {measure::report_type::averages, measure::report_type::full,
+                    measure::report_type::calls}) {
+    EXPECT_EQ(to_json(mon.report(type)), to_json(mon.report(type, 3)));
+  }
+}
+
+TEST(metric_window_test, forgets_calls_older_than_the_window) {
+  using window = measure::window_timer<60, 1000000>;
+  const window::usec_t second = 1000000;
+  const window::usec_t t0 = 1000 * second;
+
+  window w;
+  w.add(100, t0);
+  w.add(300, t0 + 30 * second);
+  EXPECT_EQ(2u, w.window(60 * second, t0 + 30 * second).calls());
+  EXPECT_EQ(200, w.window(60 * second, t0 + 30 * second).avg());
+
+  EXPECT_EQ(1u, w.window(60 * second, t0 + 70 * second).calls());
+  EXPECT_EQ(1u, w.window(10 * second, t0 + 35 * second).calls());
+  EXPECT_EQ(0u, w.window(60 * second, t0 + 100 * second).calls());
+
+  w.add(50, t0 + 200 * second);
+  EXPECT_EQ(1u, w.window(60 * second, t0 + 200 * second).calls());
+  EXPECT_DOUBLE_EQ(1.0 / 60, w.rate(60 * second, t0 + 200 * second));
+  EXPECT_EQ(3u, w.calls());
+  EXPECT_EQ(450u, w.elapsed());
+}
+
+TEST(metric_window_test, merges_aligned_buckets) {
+  using window = measure::window_timer<10, 1000000>;
+  const window::usec_t second = 1000000;
+  const window::usec_t t0 = 1000 * second;
+
+  window lhs, rhs;
+  lhs.add(10, t0);
+  rhs.add(20, t0 + 5 * second);
+  rhs.add(30, t0 + 12 * second);
+
+  lhs += rhs;
+  EXPECT_EQ(3u, lhs.calls());
+  EXPECT_EQ(2u, lhs.window(10 * second, t0 + 12 * second).calls());
+  EXPECT_EQ(25, lhs.window(10 * second, t0 + 12 * second).avg());
+}
+
+TEST(metric_window_test, reports_recent_windows) {
+  measure::monitor<int, measure::window_timer<>> mon;
+  mon.start(1);
+  mon.stop();
+
+  auto details = to_json(mon.report(measure::report_type::details));
+  EXPECT_NE(std::string::npos, details.find("1m avg="));
+  EXPECT_NE(std::string::npos, details.find("rate="));
+  EXPECT_NE(std::string::npos, details.find("5m avg="));
+}
+
+TEST(metric_throughput_test, counts_items_and_bytes_of_current_scope) {
+  measure::monitor<int, measure::throughput_timer> mon;
+  mon.count(5); // no open scope
+
+  mon.start(1);
+  mon.count(2);
+  mon.start(2);
+  mon.count();
+  mon.add_bytes(100);
+  mon.stop();
+  mon.add_bytes(10);
+  mon.stop();
+
+  mon.disable();
+  mon.start(1);
+  mon.count(1000);
+  mon.stop();
+
+  auto &trie = mon.storage();
+  auto top = trie.first_root();
+  auto child = trie.first_child(top);
+  EXPECT_EQ(2u, trie.value(top).items());
+  EXPECT_EQ(10u, trie.value(top).bytes());
+  EXPECT_EQ(1u, trie.value(child).items());
+  EXPECT_EQ(100u, trie.value(child).bytes());
+}
+
+TEST(metric_throughput_test, derives_rates) {
+  measure::throughput_timer t(2000, 4);
+  t.count(8);
+  t.add_bytes(1000);
+
+  EXPECT_EQ(2, t.items_per_call());
+  EXPECT_EQ(250000, t.ns_per_item());
+  EXPECT_EQ(500000, t.bytes_per_sec());
+
+  std::stringstream ss;
+  measure::describe(ss, t);
+  EXPECT_EQ("items/call=2 ns/item=250000 bytes/s=500000", ss.str());
+}
+
+TEST(metric_throttled_test, throttles_scopes_as_short_as_the_overhead) {
+  measure::monitor<int, measure::throttled_timer<16>> mon;
+  for (int i = 0; i < 10000; ++i) {
+    mon.start(1);
+    mon.stop();
+  }
+
+  auto &val = mon.storage().value(mon.storage().first_root());
+  EXPECT_TRUE(val.throttled());
+  EXPECT_EQ(10000u, val.calls());
+  EXPECT_GT(2000u, val.sampled());
+
+  auto details = to_json(mon.report(measure::report_type::details));
+  EXPECT_NE(std::string::npos, details.find("throttled=1/16"));
+}
+
+TEST(metric_throttled_test, keeps_period_on_clone_and_combine) {
+  measure::monitor<int, measure::throttled_timer<16>> mon, other;
+  for (int i = 0; i < 10000; ++i) {
+    mon.start(1);
+    mon.stop();
+  }
+  other.start(1);
+  other.stop();
+
+  auto clone = mon.clone();
+  auto combine = other.combine(mon);
+  for (auto *m : {&clone, &combine}) {
+    auto &val = m->storage().value(m->storage().first_root());
+    EXPECT_TRUE(val.throttled());
+
+    auto details = to_json(m->report(measure::report_type::details));
+    EXPECT_NE(std::string::npos, details.find("throttled=1/16"));
+  }
+}
+
+TEST(metric_throttled_test, times_every_call_of_long_scopes) {
+  measure::throttled_timer<16> t;
+  for (int i = 0; i < 70; ++i) {
+    t.start();
+    usleep(100);
+    t.stop();
+  }
+
+  EXPECT_FALSE(t.throttled());
+  EXPECT_EQ(70u, t.sampled());
+  EXPECT_LE(7000u, t.elapsed());
+}
+
+TEST(metric_exemplar_test, keeps_slowest_calls) {
+  measure::exemplar_timer<3> t;
+  const unsigned long long durations[] = {5, 50, 1, 20, 40, 2, 30};
+  for (unsigned i = 0; i < 7; ++i) {
+    t.add(durations[i], 1000 + i, 100 + i);
+  }
+
+  auto kept = t.exemplars();
+  ASSERT_EQ(3u, kept.size());
+  EXPECT_EQ(50u, kept[0].duration);
+  EXPECT_EQ(101u, kept[0].tag);
+  EXPECT_EQ(1001u, kept[0].timestamp);
+  EXPECT_EQ(40u, kept[1].duration);
+  EXPECT_EQ(30u, kept[2].duration);
+  EXPECT_EQ(7u, t.calls());
+  EXPECT_EQ(148u, t.elapsed());
+
+  measure::exemplar_timer<3> other;
+  other.add(45, 2000, 7);
+  t += other;
+  kept = t.exemplars();
+  EXPECT_EQ(45u, kept[1].duration);
+  EXPECT_EQ(7u, kept[1].tag);
+  EXPECT_EQ(8u, t.calls());
+}
+
+TEST(metric_exemplar_test, tags_calls_with_thread_tag) {
+  measure::monitor<int, measure::exemplar_timer<2>> mon;
+  measure::set_exemplar_tag(42);
+  mon.start(1);
+  mon.stop();
+  measure::set_exemplar_tag(0);
+
+  auto details = to_json(mon.report(measure::report_type::details));
+  EXPECT_NE(std::string::npos, details.find("#42@"));
+}
+
+TEST(metric_cpu_test, separates_cpu_from_off_cpu_time) {
+  measure::monitor<int, measure::cpu_timer> mon;
+  mon.start(1);
+  usleep(20000);
+  mon.stop();
+
+  mon.start(2);
+  const auto begin = measure::cpu_timer::now();
+  while (measure::cpu_timer::now() - begin < 20000) {
+  }
+  mon.stop();
+
+  auto &trie = mon.storage();
+  for (auto n = trie.first_root(); n; n = trie.next_sibling(n)) {
+    auto &val = trie.value(n);
+    if (trie.key(n) == 1) {
+      EXPECT_LT(val.cpu(), val.off_cpu());
+    } else {
+      EXPECT_LE(20000u, val.cpu());
+      EXPECT_GE(val.elapsed(), val.cpu());
+    }
+  }
+
+  auto details = to_json(mon.report(measure::report_type::details));
+  EXPECT_NE(std::string::npos, details.find("off-cpu="));
+}
+
+TEST(metric_cpu_test, caps_cpu_time_at_wall_time) {
+  measure::cpu_timer t;
+  t.add(10, 15);
+  t.add(20, 5);
+  EXPECT_EQ(2u, t.calls());
+  EXPECT_EQ(30u, t.elapsed());
+  EXPECT_EQ(15u, t.cpu());
+  EXPECT_EQ(15u, t.off_cpu());
+}
+
+TEST_F(metric_monitors_test, mutes_subtrees) {
+  mon.mute({1, 2});
+
+  mon.start(1);
+  mon.start(2);
+  mon.start(3);
+  mon.stop();
+  mon.stop();
+  mon.start(4);
+  mon.stop();
+  mon.stop();
+  EXPECT_EQ("{1:{#:1,2:0,4:1}}", exact_report(mon, measure::report_type::calls));
+
+  mon.unmute({1, 2});
+  mon.start(1);
+  mon.start(2);
+  mon.stop();
+  mon.stop();
+  EXPECT_EQ("{1:{#:2,2:1,4:1}}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, keeps_muted_nodes_on_eviction) {
+  mon.mute({1});
+  mon.start(0);
+  mon.stop();
+  mon.evict(1);
+  mon.evict(1);
+
+  mon.start(1);
+  mon.start(2);
+  mon.stop();
+  mon.stop();
+  EXPECT_EQ("{1:0}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST(metric_filter_test, accepts_filters_from_other_threads) {
+  measure::monitor<std::string_view> mon;
+  std::thread admin([&mon] {
+    for (int i = 0; i < 100; ++i) {
+      mon.mute({"handler", "db"});
+      mon.unmute({"handler", "db"});
+    }
+    mon.mute({"handler", "db"});
+  });
+
+  for (int i = 0; i < 1000; ++i) {
+    mon.start("handler");
+    mon.start("db");
+    mon.stop();
+    mon.stop();
+  }
+  admin.join();
+
+  mon.start("handler");
+  mon.start("db");
+  mon.start("query");
+  mon.stop();
+  mon.stop();
+  mon.stop();
+  EXPECT_EQ(0u, mon.depth());
+  EXPECT_EQ(2u, mon.size());
+}
+
+TEST_F(metric_monitors_test, keeps_muted_descendants_on_eviction) {
+  mon.mute({1, 2});
+  mon.start(0);
+  mon.stop();
+  mon.evict(1);
+  mon.evict(1);
+
+  mon.start(1);
+  mon.start(2);
+  mon.stop();
+  mon.stop();
+  EXPECT_EQ("{1:{#:1,2:0}}", exact_report(mon, measure::report_type::calls));
+
+  mon.unmute({1, 2});
+  mon.start(0);
+  mon.stop();
+  mon.evict(1);
+  mon.evict(1);
+  EXPECT_EQ("{}", exact_report(mon, measure::report_type::calls));
+}
+
+TEST_F(metric_monitors_test, applies_filters_inside_open_scopes) {
+  mon.start(1);
+  mon.mute({1, 2});
+  mon.start(2);
+  mon.start(3);
+  mon.stop();
+  mon.stop();
+  mon.stop();
+  EXPECT_EQ("{1:{#:1,2:0}}", exact_report(mon, measure::report_type::calls));
+}
@@ -0,0 +1,115 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "measure/openmetrics.h"
+#include <gtest/gtest.h>
+
+namespace {
+std::string fetch(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+    close(fd);
+    return "";
+  }
+
+  const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+  send(fd, request.data(), request.size(), 0);
+
+  std::string response;
+  char buf[512];
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+    response.append(buf, n);
+  }
+  close(fd);
+  return response;
+}
+} // namespace
+
+TEST(metric_openmetrics_test, writes_counter_families) {
+  measure::monitor<int> mon;
+  mon.add(std::vector<int>{1}, measure::aggregate_timer(100, 4));
+  mon.add(std::vector<int>{1, 2}, measure::aggregate_timer(50, 2));
+
+  std::string out;
+  measure::write_openmetrics(out, mon);
+  EXPECT_EQ("# TYPE measure_time_microseconds counter\n"
+            "# UNIT measure_time_microseconds microseconds\n"
+            "measure_time_microseconds_total{path=\"1\"} 100\n"
+            "measure_time_microseconds_total{path=\"1/2\"} 50\n"
+            "# TYPE measure_calls counter\n"
+            "measure_calls_total{path=\"1\"} 4\n"
+            "measure_calls_total{path=\"1/2\"} 2\n"
+            "# EOF\n",
+            out);
+}
+
+TEST(metric_openmetrics_test, escapes_string_keys) {
+  measure::monitor<std::string_view> mon;
+  mon.add(std::vector<std::string_view>{"say \"hi\"", "a\\b"},
+          measure::aggregate_timer(1, 1));
+
+  std::string out;
+  measure::write_openmetrics(out, mon, "app");
+  EXPECT_NE(std::string::npos,
+            out.find("app_calls_total{path=\"say \\\"hi\\\"/a\\\\b\"} 1\n"));
+}
+
+TEST(metric_openmetrics_test, encodes_separators_inside_keys) {
+  using path = std::vector<std::string_view>;
+  measure::monitor<std::string_view> mon;
+  mon.add(path{"a/b"}, measure::aggregate_timer(1, 1));
+  mon.add(path{"a", "b"}, measure::aggregate_timer(1, 2));
+  mon.add(path{"a%2Fb"}, measure::aggregate_timer(1, 3));
+
+  std::string out;
+  measure::write_openmetrics(out, mon, "app");
+  EXPECT_NE(std::string::npos, out.find("calls_total{path=\"a%2Fb\"} 1\n"));
+  EXPECT_NE(std::string::npos, out.find("calls_total{path=\"a/b\"} 2\n"));
+  EXPECT_NE(std::string::npos, out.find("calls_total{path=\"a%252Fb\"} 3\n"));
+}
+
+TEST(metric_openmetrics_test, serves_published_snapshot) {
+  measure::monitor<int> mon;
+  mon.add(std::vector<int>{7}, measure::aggregate_timer(10, 3));
+
+  measure::openmetrics_server server;
+  ASSERT_NE(0, server.port());
+  EXPECT_NE(std::string::npos, fetch(server.port()).find("\r\n\r\n# EOF\n"));
+
+  server.publish(mon);
+  mon.add(std::vector<int>{7}, measure::aggregate_timer(10, 3));
+
+  const auto response = fetch(server.port());
+  EXPECT_EQ(0u, response.find("HTTP/1.0 200 OK\r\n"));
+  EXPECT_NE(std::string::npos,
+            response.find("measure_calls_total{path=\"7\"} 3\n"));
+}
@@ -0,0 +1,81 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "measure/perf.h"
+#include <gtest/gtest.h>
+
+struct metric_perf_test : ::testing::Test {
+  using mon_t = measure::monitor<char, measure::perf_timer>;
+  mon_t mon;
+};
+
+TEST_F(metric_perf_test, counts_calls_with_or_without_counters) {
+  mon.start('a');
+  mon.stop();
+  mon.start('a');
+  mon.stop();
+
+  auto rep = mon.report(measure::report_type::calls);
+  EXPECT_EQ("2", rep['a']);
+}
+
+TEST_F(metric_perf_test, reports_counter_columns) {
+  mon.start('a');
+  mon.stop();
+
+  auto rep = mon.report(measure::report_type::details);
+  EXPECT_EQ(0u, rep['a'].find("ipc="));
+  EXPECT_NE(std::string::npos, rep['a'].find("cache-misses/call="));
+  EXPECT_NE(std::string::npos, rep['a'].find("branch-misses/call="));
+}
+
+TEST_F(metric_perf_test, counts_instructions_when_available) {
+  if (!measure::perf_timer::available()) {
+    GTEST_SKIP() << "hardware counters are not available";
+  }
+
+  measure::perf_timer timer;
+  timer.start();
+  volatile int sum = 0;
+  for (int i = 0; i < 1000; ++i) {
+    sum += i;
+  }
+  timer.stop();
+
+  EXPECT_LT(0u, timer.instructions());
+}
+
+TEST_F(metric_perf_test, combines_counters) {
+  mon_t lhs;
+  lhs.start('a');
+  lhs.stop();
+  mon.start('a');
+  mon.stop();
+
+  auto combine = mon.combine(lhs);
+  EXPECT_EQ("2", combine.report(measure::report_type::calls)['a']);
+}
@@ -0,0 +1,127 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "measure/concurrent_pool.h"
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+
+TEST(metric_pool_test, reuses_freed_objects) {
+  measure::concurrent_pool<long> pool;
+  auto a = pool.construct(1);
+  auto b = pool.construct(2);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(1, *a);
+
+  pool.destroy(a);
+  EXPECT_EQ(a, pool.alloc());
+  pool.dealloc(a);
+  pool.dealloc(b);
+}
+
+TEST(metric_pool_test, returns_batches_to_the_central_pool) {
+  measure::concurrent_pool<long, 8> pool;
+  std::vector<long *> objects;
+  for (int i = 0; i < 100; ++i) {
+    objects.push_back(pool.alloc());
+  }
+  EXPECT_EQ(104u, pool.central_size());
+
+  for (auto o : objects) {
+    pool.dealloc(o);
+  }
+  EXPECT_GE(16u, pool.central_size());
+}
+
+TEST(metric_pool_test, frees_objects_on_other_threads) {
+  measure::concurrent_pool<long> pool;
+  std::vector<long *> objects;
+  for (int i = 0; i < 1000; ++i) {
+    objects.push_back(pool.construct(i));
+  }
+
+  std::thread releaser([&] {
+    for (auto o : objects) {
+      pool.destroy(o);
+    }
+  });
+  releaser.join();
+
+  // every remotely freed object comes back, give or take one batch of
+  // other free objects in the magazine
+  std::set<long *> freed(objects.begin(), objects.end());
+  std::size_t reused = 0;
+  for (int i = 0; i < 1000 + 2 * 32; ++i) {
+    reused += freed.count(pool.alloc());
+  }
+  EXPECT_EQ(1000u, reused);
+}
+
+TEST(metric_pool_test, allocates_from_many_threads) {
+  measure::concurrent_pool<long> pool;
+  std::vector<std::thread> threads;
+  std::atomic<int> errors{0};
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t] {
+      std::vector<long *> mine;
+      for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 100; ++i) {
+          mine.push_back(pool.construct(t * 1000 + i));
+        }
+        for (int i = 0; i < 100; ++i) {
+          if (*mine[i] != t * 1000 + i) {
+            ++errors;
+          }
+          pool.destroy(mine[i]);
+        }
+        mine.clear();
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(0, errors);
+}
+
+TEST(metric_pool_test, ignores_magazines_of_destroyed_pools) {
+  for (int i = 0; i < 100; ++i) {
+    // the first pool leaves a magazine in this thread's cache
+    auto first = std::make_unique<measure::concurrent_pool<long>>();
+    first->dealloc(first->alloc());
+    first.reset();
+
+    // the second takes over its slot, but not its magazine: objects freed
+    // here before any allocation go to the remote stack
+    measure::concurrent_pool<long> second;
+    long *o = nullptr;
+    std::thread([&] { o = second.alloc(); }).join();
+    second.dealloc(o);
+    EXPECT_EQ(o, second.alloc());
+    second.dealloc(o);
+  }
+}
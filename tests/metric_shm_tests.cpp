@@ -0,0 +1,118 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "measure/shm.h"
+#include <gtest/gtest.h>
+
+struct metric_shm_test : ::testing::Test {
+  std::string name = "/measure-test-" + std::to_string(getpid());
+};
+
+TEST_F(metric_shm_test, publishes_records_in_preorder) {
+  measure::monitor<int> mon;
+  mon.start(1);
+  mon.start(2);
+  mon.stop();
+  mon.stop();
+  mon.start(3);
+  mon.stop();
+
+  measure::shm_writer writer(name, 16);
+  writer.publish(mon);
+
+  measure::shm_reader reader(name);
+  std::vector<measure::shm_record> records;
+  uint32_t flags = 0;
+  EXPECT_EQ(2u, reader.read(records, &flags));
+  EXPECT_EQ(0u, flags);
+
+  ASSERT_EQ(3u, records.size());
+  EXPECT_EQ(3, records[0].key);
+  EXPECT_EQ(measure::shm_no_parent, records[0].parent);
+  EXPECT_EQ(1, records[1].key);
+  EXPECT_EQ(2, records[2].key);
+  EXPECT_EQ(1u, records[2].parent);
+  EXPECT_EQ(1u, records[2].depth);
+  EXPECT_EQ(1u, records[2].calls);
+}
+
+TEST_F(metric_shm_test, stores_string_keys_by_name) {
+  measure::monitor<const char *> mon;
+  mon.start("handler");
+  mon.stop();
+
+  measure::shm_writer writer(name, 16);
+  writer.publish(mon);
+  writer.publish(mon);
+
+  measure::shm_reader reader(name);
+  std::vector<measure::shm_record> records;
+  EXPECT_EQ(4u, reader.read(records));
+  ASSERT_EQ(1u, records.size());
+  EXPECT_STREQ("handler", records[0].name);
+}
+
+TEST_F(metric_shm_test, flags_truncated_snapshot) {
+  measure::monitor<int> mon;
+  for (int i = 0; i < 4; ++i) {
+    mon.start(i);
+    mon.stop();
+  }
+
+  measure::shm_writer writer(name, 2);
+  writer.publish(mon);
+
+  measure::shm_reader reader(name);
+  std::vector<measure::shm_record> records;
+  uint32_t flags = 0;
+  reader.read(records, &flags);
+  EXPECT_EQ(2u, records.size());
+  EXPECT_EQ(measure::shm_truncated, flags);
+}
+
+TEST_F(metric_shm_test, gives_up_on_a_stalled_writer) {
+  measure::monitor<int> mon;
+  measure::shm_writer writer(name, 2);
+  writer.publish(mon);
+
+  // leave the generation odd, as a writer dying mid-publish would
+  const int fd = shm_open(name.c_str(), O_RDWR, 0);
+  ASSERT_NE(-1, fd);
+  auto p = mmap(nullptr, sizeof(measure::shm_header), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+  close(fd);
+  ASSERT_NE(MAP_FAILED, p);
+  static_cast<measure::shm_header *>(p)->generation.fetch_add(1);
+
+  measure::shm_reader reader(name);
+  std::vector<measure::shm_record> records;
+  EXPECT_THROW(reader.read(records, nullptr, 10000), std::runtime_error);
+
+  static_cast<measure::shm_header *>(p)->generation.fetch_add(1);
+  EXPECT_EQ(4u, reader.read(records, nullptr, 10000));
+  munmap(p, sizeof(measure::shm_header));
+}
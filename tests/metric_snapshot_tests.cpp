@@ -0,0 +1,128 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "measure/snapshot.h"
+#include <gtest/gtest.h>
+
+struct metric_snapshot_test : ::testing::Test {
+  template <typename Monitor> std::string save(const Monitor &mon) {
+    std::stringstream ss;
+    measure::write_snapshot(ss, mon);
+    return ss.str();
+  }
+
+  template <typename Monitor> void load(const std::string &data, Monitor &mon) {
+    std::stringstream ss(data);
+    measure::read_snapshot(ss, mon);
+  }
+
+  template <typename Monitor> std::string calls(Monitor &mon) {
+    return mon.report_json(measure::report_type::calls);
+  }
+};
+
+TEST_F(metric_snapshot_test, round_trips_integer_keys) {
+  measure::monitor<int> mon, copy;
+  mon.start(1);
+  mon.start(2);
+  mon.stop();
+  mon.stop();
+  mon.start(3);
+  mon.stop();
+
+  load(save(mon), copy);
+  EXPECT_EQ(calls(mon), calls(copy));
+}
+
+TEST_F(metric_snapshot_test, merges_snapshots_incrementally) {
+  measure::monitor<std::string> lhs, rhs, aggregate;
+  lhs.start("a long key that does not fit into small string storage");
+  lhs.stop();
+  rhs.start("a long key that does not fit into small string storage");
+  rhs.start("b");
+  rhs.stop();
+  rhs.stop();
+
+  load(save(lhs), aggregate);
+  load(save(rhs), aggregate);
+
+  const std::string key =
+      "a long key that does not fit into small string storage";
+  const std::vector<std::string> path = {key, "b"};
+  auto rep = aggregate.report(measure::report_type::calls);
+  EXPECT_EQ("2", rep[key]);
+  EXPECT_EQ("1", rep[path]);
+}
+
+TEST_F(metric_snapshot_test, reads_integer_keys_as_strings) {
+  measure::monitor<int> mon;
+  mon.start(42);
+  mon.stop();
+
+  measure::monitor<std::string> aggregate;
+  load(save(mon), aggregate);
+  auto rep = aggregate.report(measure::report_type::calls);
+  EXPECT_EQ("1", rep[std::string("42")]);
+}
+
+TEST_F(metric_snapshot_test, round_trips_string_view_keys) {
+  measure::monitor<std::string_view> mon, copy;
+  mon.start("db");
+  mon.start("handler");
+  mon.stop();
+  mon.stop();
+  mon.start("dispatch");
+  mon.stop();
+
+  load(save(mon), copy);
+  EXPECT_EQ(calls(mon), calls(copy));
+  const std::vector<std::string> path = {"db", "handler"};
+  auto rep = copy.report(measure::report_type::calls);
+  EXPECT_EQ("1", rep[path]);
+  EXPECT_EQ("1", rep[std::string("dispatch")]);
+}
+
+TEST_F(metric_snapshot_test, rejects_malformed_input) {
+  measure::monitor<int> mon;
+  EXPECT_THROW(load("garbage", mon), std::runtime_error);
+
+  measure::monitor<const char *> strings;
+  strings.start("a");
+  strings.stop();
+  EXPECT_THROW(load(save(strings), mon), std::runtime_error);
+}
+
+TEST_F(metric_snapshot_test, writes_folded_stacks) {
+  measure::monitor<int> mon;
+  mon.add(std::vector<int>{1}, measure::aggregate_timer(10, 1));
+  mon.add(std::vector<int>{1, 2}, measure::aggregate_timer(4, 1));
+  mon.add(std::vector<int>{3}, measure::aggregate_timer(0, 1));
+
+  std::stringstream ss;
+  measure::write_folded(ss, mon);
+  EXPECT_EQ("1 6\n1;2 4\n", ss.str());
+}
@@ -0,0 +1,96 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "measure/measure.h"
+#include <gtest/gtest.h>
+
+struct metric_tree_test : ::testing::Test {
+  using tree_t = measure::tree<int, std::string>;
+  tree_t tree;
+
+  std::string keys() {
+    std::string res;
+    tree.foreach ([&res](int key, const std::string &) {
+      res += std::to_string(key) + ' ';
+    });
+    return res;
+  }
+};
+
+TEST_F(metric_tree_test, stores_values_by_path) {
+  const std::vector<int> path = {1, 2};
+  tree[path] = "12";
+  tree[3] = "3";
+
+  EXPECT_EQ("12", tree[path]);
+  EXPECT_EQ("3", tree[3]);
+  EXPECT_EQ("", tree[1]);
+}
+
+TEST_F(metric_tree_test, keeps_children_sorted) {
+  for (auto k : {5, 3, 9, 1, 7, 2}) {
+    tree[k] = "";
+  }
+
+  EXPECT_EQ("1 2 3 5 7 9 ", keys());
+}
+
+TEST_F(metric_tree_test, keeps_value_references_while_growing) {
+  auto &first = tree[0];
+  first = "first";
+  for (int i = 1; i < 1000; ++i) {
+    tree[std::vector<int>{i, i}] = "";
+  }
+
+  EXPECT_EQ("first", first);
+  EXPECT_EQ(1999u, tree.size());
+}
+
+TEST_F(metric_tree_test, erases_subtree) {
+  tree[std::vector<int>{1, 2, 3}] = "";
+  tree[std::vector<int>{1, 4}] = "";
+
+  tree.erase(std::vector<int>{1, 2});
+  EXPECT_EQ("1 4 ", keys());
+  EXPECT_EQ(2u, tree.size());
+  EXPECT_EQ(0u, tree.count(std::vector<int>{1, 2}));
+  EXPECT_EQ(1u, tree.count(std::vector<int>{1, 4}));
+}
+
+TEST_F(metric_tree_test, moves_tree) {
+  tree[1] = "1";
+  tree_t other = std::move(tree);
+
+  EXPECT_TRUE(tree.empty());
+  EXPECT_EQ("1", other[1]);
+  EXPECT_EQ("{\n    \"1\":\"1\"\n}", measure::to_json(other));
+}
+
+TEST_F(metric_tree_test, throws_on_missing_const_lookup) {
+  const auto &ctree = tree;
+  EXPECT_THROW(ctree[1], std::exception);
+}
@@ -256,3 +256,175 @@ TEST_F(metric_trie_test, aggregates_tries) {
   auto combine = rhs.combine(lhs);
   EXPECT_EQ(33, combine.at({1}));
 }
+
+TEST_F(metric_trie_test, creates_several_top_level_paths) {
+  trie.create({1, 2}) = 12;
+  trie.create({3}) = 3;
+  trie.create(std::vector<int>{1, 4}) = 14;
+
+  EXPECT_EQ(12, trie.at({1, 2}));
+  EXPECT_EQ(3, trie.at({3}));
+  EXPECT_EQ(14, trie.at({1, 4}));
+}
+
+TEST_F(metric_trie_test, keeps_values_in_dense_slots) {
+  auto &first = trie.down(0);
+  first = 7;
+  for (int i = 1; i < 3000; ++i) {
+    trie.down(i) = i;
+  }
+
+  EXPECT_EQ(7, first);
+  EXPECT_EQ(3000u, trie.value_slots());
+
+  long sum = 0;
+  trie.foreach_value([&sum](std::size_t slot, int &val) {
+    sum += val;
+    val = static_cast<int>(slot);
+  });
+  EXPECT_EQ(7 + 2999L * 3000 / 2, sum);
+  EXPECT_EQ(2, trie.at({0, 1, 2}));
+}
+
+TEST_F(metric_trie_test, evicts_idle_subtrees) {
+  trie.create({1, 2}) = 12;
+  trie.create({3, 4}) = 34;
+  EXPECT_EQ(4u, trie.size());
+
+  EXPECT_EQ(0u, trie.evict(2));
+
+  trie.down(1);
+  trie.up();
+  EXPECT_EQ(0u, trie.evict(2));
+
+  trie.down(1);
+  trie.down(2);
+  trie.up();
+  trie.up();
+  EXPECT_EQ(2u, trie.evict(2));
+
+  EXPECT_EQ(2u, trie.size());
+  EXPECT_TRUE(trie.has({1, 2}));
+  EXPECT_FALSE(trie.has({3}));
+}
+
+TEST_F(metric_trie_test, keeps_cursor_path_on_eviction) {
+  trie.down(1);
+  trie.down(2) = 12;
+  trie.evict(1);
+  trie.evict(1);
+
+  EXPECT_EQ(2u, trie.size());
+  EXPECT_EQ(12, trie.up());
+}
+
+TEST_F(metric_trie_test, evicts_by_decayed_rate) {
+  for (int i = 0; i < 8; ++i) {
+    trie.down(1);
+    trie.up();
+  }
+  trie.down(2);
+  trie.up();
+  EXPECT_EQ(0u, trie.evict(0, 2));
+
+  trie.down(1);
+  trie.up();
+  EXPECT_EQ(1u, trie.evict(0, 2));
+  EXPECT_TRUE(trie.has({1}));
+  EXPECT_FALSE(trie.has({2}));
+}
+
+TEST_F(metric_trie_test, reuses_evicted_nodes) {
+  for (int i = 0; i < 100; ++i) {
+    trie.create({i, 0}) = i;
+  }
+  trie.evict(1);
+  EXPECT_EQ(200u, trie.evict(1));
+  const auto slots = trie.value_slots();
+
+  for (int i = 100; i < 200; ++i) {
+    trie.create({i, 0}) = i;
+  }
+  EXPECT_EQ(slots, trie.value_slots());
+  EXPECT_EQ(200u, trie.size());
+  EXPECT_EQ(150, trie.at({150, 0}));
+}
+
+TEST_F(metric_trie_test, reserves_nodes_and_values) {
+  trie.down(0);
+  trie.reserve(3000);
+  const auto allocations = trie.allocations();
+
+  for (int i = 1; i <= 3000; ++i) {
+    trie.down(i);
+  }
+  EXPECT_EQ(allocations, trie.allocations());
+  EXPECT_EQ(3001u, trie.size());
+}
+
+TEST_F(metric_trie_test, visits_wide_and_deep_tries_without_recursion) {
+  // every new sibling scans the ones before it, so the wide level is kept
+  // small; the deep chain is what would overflow a recursive visit
+  trie.down(0);
+  for (int i = 0; i < 2000; ++i) {
+    trie.down(i);
+    trie.up();
+  }
+  trie.up();
+  for (int i = 0; i < 50000; ++i) {
+    trie.down(i);
+  }
+  for (int i = 0; i < 50000; ++i) {
+    trie.up();
+  }
+
+  std::size_t visited = 0;
+  unsigned max_depth = 0;
+  trie.visit([&](unsigned depth, auto) {
+    ++visited;
+    max_depth = std::max(max_depth, depth);
+  });
+  EXPECT_EQ(trie.size(), visited);
+  EXPECT_EQ(49999u, max_depth);
+
+  auto copy = trie.clone();
+  EXPECT_EQ(trie.size(), copy.size());
+}
+
+TEST_F(metric_trie_test, visits_children_before_parents) {
+  trie.create({1, 2, 3});
+  trie.create({1, 4});
+  trie.create({5});
+
+  std::string order;
+  trie.visit_postorder([&](unsigned depth, auto n) {
+    order += std::to_string(trie.key(n)) + ":" + std::to_string(depth) + " ";
+  });
+  EXPECT_EQ("5:0 3:2 2:1 4:1 1:0 ", order);
+}
+
+TEST_F(metric_trie_test, visits_top_level_subtrees_in_parallel) {
+  for (int i = 0; i < 20; ++i) {
+    for (int j = 0; j < i; ++j) {
+      trie.create({i, j, j}) = i + j;
+    }
+  }
+
+  std::vector<int> seen(trie.value_slots());
+  trie.visit_parallel(4, [&](unsigned depth, auto n) {
+    seen[trie.slot(n)] += depth + 1;
+  });
+
+  std::vector<int> expected(trie.value_slots());
+  trie.visit([&](unsigned depth, auto n) { expected[trie.slot(n)] += depth + 1; });
+  EXPECT_EQ(expected, seen);
+}
+
+TEST_F(metric_trie_test, accounts_for_memory) {
+  const auto empty = trie.memory();
+  for (int i = 0; i < 100; ++i) {
+    trie.create({i});
+  }
+  EXPECT_LT(empty, trie.memory());
+  EXPECT_LE(100 * sizeof(int), trie.memory() - empty);
+}
@@ -0,0 +1,133 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "measure/snapshot.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+using monitor_t = measure::monitor<std::string>;
+
+void usage() {
+  std::cerr << "usage: measure-merge [-f json|folded|binary] [-r report] "
+               "[-o output] snapshot...\n"
+               "  -f  output format, json by default\n"
+               "  -r  json report type: averages (default), calls, totals,\n"
+               "      percentages or full\n"
+               "  -o  output file, stdout by default\n";
+}
+
+bool parse_report(const char *name, measure::report_type &type) {
+  static const std::pair<const char *, measure::report_type> types[] = {
+      {"averages", measure::report_type::averages},
+      {"calls", measure::report_type::calls},
+      {"totals", measure::report_type::totals},
+      {"percentages", measure::report_type::percentages},
+      {"full", measure::report_type::full}};
+
+  for (auto &t : types) {
+    if (!strcmp(t.first, name)) {
+      type = t.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string format = "json";
+  std::string output;
+  auto report = measure::report_type::averages;
+  std::vector<const char *> inputs;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (!strcmp(argv[i], "-f") && has_value) {
+      format = argv[++i];
+    } else if (!strcmp(argv[i], "-o") && has_value) {
+      output = argv[++i];
+    } else if (!strcmp(argv[i], "-r") && has_value) {
+      if (!parse_report(argv[++i], report)) {
+        usage();
+        return 2;
+      }
+    } else if (argv[i][0] == '-') {
+      usage();
+      return 2;
+    } else {
+      inputs.push_back(argv[i]);
+    }
+  }
+
+  if (inputs.empty() ||
+      (format != "json" && format != "folded" && format != "binary")) {
+    usage();
+    return 2;
+  }
+
+  // snapshots are folded into the aggregate one at a time
+  monitor_t aggregate;
+  for (auto path : inputs) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      std::cerr << "measure-merge: cannot open " << path << '\n';
+      return 1;
+    }
+
+    try {
+      measure::read_snapshot(in, aggregate);
+    } catch (const std::exception &e) {
+      std::cerr << "measure-merge: " << path << ": " << e.what() << '\n';
+      return 1;
+    }
+  }
+
+  std::ofstream file;
+  if (!output.empty()) {
+    file.open(output, std::ios::binary);
+    if (!file) {
+      std::cerr << "measure-merge: cannot write " << output << '\n';
+      return 1;
+    }
+  }
+  std::ostream &out = output.empty() ? std::cout : file;
+
+  if (format == "json") {
+    out << aggregate.report_json(report) << '\n';
+  } else if (format == "folded") {
+    measure::write_folded(out, aggregate);
+  } else {
+    measure::write_snapshot(out, aggregate);
+  }
+
+  return out ? 0 : 1;
+}